@@ -0,0 +1,735 @@
+/**
+ * @file bench.c
+ * @brief File System Operations Library (libfsop)
+ *        Benchmark Harness
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Generates synthetic trees under a work directory and runs the libfsop copy,
+ * walk, move and remove operations over them, for every combination of block
+ * size and thread count requested. Copies of the large file datasets are also
+ * measured with preallocated destinations ("cpprealloc") and as delta copies
+ * ("cpdelta"), after a single block of each copy is overwritten. Each run
+ * prints one CSV record to stdout:
+ *
+ *   op,dataset,block,threads,engine,seconds,bytes,files,mb_s,files_s,
+ *   syscr,syscw,syscalls,allocs,frees,arena_allocs,maxrss_kb
+ *
+ * 'syscr' and 'syscw' are the read and write system calls issued during the
+ * run, as reported by /proc/self/io (-1 where unavailable). 'syscalls' is the
+ * number of file system calls issued by the library itself, summed over the
+ * FSOP_STAT_SYS_* counters, and 'allocs', 'frees' and 'arena_allocs' are the
+ * heap allocations, heap releases and arena allocations it made (all -1 when
+ * the library was built without statistics). 'maxrss_kb' is the peak resident
+ * set size of the process so far. The page cache is not dropped between runs.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "file.h"
+#include "dir.h"
+#include "stats.h"
+
+#define BENCH_PATH_MAX		4096
+#define BENCH_LIST_MAX		16
+
+#define BENCH_SMALL_FILES	2000
+#define BENCH_SMALL_SIZE	4096
+#define BENCH_SMALL_DIRS	20
+#define BENCH_HUGE_FILES	2
+#define BENCH_HUGE_MB		64
+#define BENCH_SPARSE_FILES	2
+#define BENCH_SPARSE_MB		256
+#define BENCH_SPARSE_STRIDE	(32UL * 1024 * 1024)
+#define BENCH_SPARSE_EXTENT	(1024UL * 1024)
+#define BENCH_DEEP_DEPTH	64
+#define BENCH_DEEP_SIZE		1024
+#define BENCH_DIRTY_SIZE	4096
+
+enum {
+	BENCH_SET_SMALL = 0x01,
+	BENCH_SET_HUGE = 0x02,
+	BENCH_SET_SPARSE = 0x04,
+	BENCH_SET_DEEP = 0x08
+};
+
+struct bench_dataset {
+	int id;
+	const char *name;
+	unsigned long long bytes;	/* Apparent size of all regular files */
+	unsigned long files;		/* Regular files */
+};
+
+struct bench_sample {
+	struct timespec ts;
+	long long syscr;
+	long long syscw;
+	struct fsop_stats stats;
+};
+
+struct bench_config {
+	const char *workdir;
+	size_t blocks[BENCH_LIST_MAX];
+	unsigned int nblocks;
+	unsigned int threads[BENCH_LIST_MAX];
+	unsigned int nthreads;
+	unsigned int repeat;
+	int engine;
+	int sets;
+	int keep;
+	unsigned long small_files;
+	unsigned long huge_mb;
+	unsigned long sparse_mb;
+	unsigned long depth;
+};
+
+static struct bench_dataset _datasets[] = {
+	{ BENCH_SET_SMALL, "small", 0, 0 },
+	{ BENCH_SET_HUGE, "huge", 0, 0 },
+	{ BENCH_SET_SPARSE, "sparse", 0, 0 },
+	{ BENCH_SET_DEEP, "deep", 0, 0 },
+	{ 0, NULL, 0, 0 }
+};
+
+static char _fill[65536];
+static int _stats = 0;		/* Library statistics are available */
+
+
+/* Sampling */
+
+static void _bench_io(long long *syscr, long long *syscw) {
+	char line[128];
+	FILE *fp = NULL;
+
+	*syscr = *syscw = -1;
+
+	if (!(fp = fopen("/proc/self/io", "r")))
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "syscr:", 6))
+			*syscr = strtoll(line + 6, NULL, 10);
+		else if (!strncmp(line, "syscw:", 6))
+			*syscw = strtoll(line + 6, NULL, 10);
+	}
+
+	fclose(fp);
+}
+
+static void _bench_sample(struct bench_sample *s) {
+	_bench_io(&s->syscr, &s->syscw);
+	fsop_stats_get(&s->stats);
+	clock_gettime(CLOCK_MONOTONIC, &s->ts);
+}
+
+static long long _bench_stat(const struct bench_sample *start, const struct bench_sample *end, int first, int last) {
+	int i = 0;
+	long long n = 0;
+
+	if (!_stats)
+		return -1;
+
+	for (i = first; i <= last; i ++)
+		n += end->stats.value[i] - start->stats.value[i];
+
+	return n;
+}
+
+static void _bench_report(
+		const char *op,
+		const struct bench_dataset *ds,
+		size_t block,
+		unsigned int threads,
+		const char *engine,
+		const struct bench_sample *start,
+		const struct bench_sample *end,
+		unsigned long long bytes,
+		unsigned long files)
+{
+	double secs = 0.0;
+	struct rusage ru;
+
+	secs = (end->ts.tv_sec - start->ts.tv_sec) + (end->ts.tv_nsec - start->ts.tv_nsec) / 1e9;
+
+	memset(&ru, 0, sizeof(ru));
+	getrusage(RUSAGE_SELF, &ru);
+
+	if (secs <= 0.0)
+		secs = 1e-9;
+
+	printf("%s,%s,%zu,%u,%s,%.6f,%llu,%lu,%.2f,%.2f,%lld,%lld,%lld,%lld,%lld,%lld,%ld\n",
+		op, ds->name, block, threads, engine, secs, bytes, files,
+		bytes / secs / (1024.0 * 1024.0), files / secs,
+		(start->syscr < 0 || end->syscr < 0) ? -1 : end->syscr - start->syscr,
+		(start->syscw < 0 || end->syscw < 0) ? -1 : end->syscw - start->syscw,
+		_bench_stat(start, end, FSOP_STAT_SYS_OPEN, FSOP_STAT_SYS_FADVISE),
+		_bench_stat(start, end, FSOP_STAT_ALLOCS, FSOP_STAT_ALLOCS),
+		_bench_stat(start, end, FSOP_STAT_FREES, FSOP_STAT_FREES),
+		_bench_stat(start, end, FSOP_STAT_ARENA_ALLOCS, FSOP_STAT_ARENA_ALLOCS),
+		ru.ru_maxrss);
+
+	fflush(stdout);
+}
+
+
+/* Dataset generation */
+
+static int _bench_path(char *path, const char *fmt, ...) {
+	int len = 0;
+	va_list ap;
+
+	va_start(ap, fmt);
+	len = vsnprintf(path, BENCH_PATH_MAX, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || len >= BENCH_PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return len;
+}
+
+static int _bench_write(const char *path, unsigned long long size) {
+	int fd = -1, errsv = 0;
+	ssize_t ret = 0;
+	size_t n = 0;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+
+	while (size) {
+		n = size < sizeof(_fill) ? size : sizeof(_fill);
+
+		if ((ret = write(fd, _fill, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		size -= ret;
+	}
+
+	return close(fd);
+
+_error:
+	errsv = errno;
+	close(fd);
+	errno = errsv;
+	return -1;
+}
+
+static int _bench_write_sparse(const char *path, unsigned long long size) {
+	int fd = -1, errsv = 0;
+	unsigned long long off = 0;
+	size_t n = 0, done = 0;
+	ssize_t ret = 0;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0)
+		goto _error;
+
+	/* One data extent at the start of every stride, holes in between */
+	for (off = 0; off < size; off += BENCH_SPARSE_STRIDE) {
+		for (done = 0; done < BENCH_SPARSE_EXTENT && off + done < size; done += ret) {
+			n = BENCH_SPARSE_EXTENT - done < sizeof(_fill) ? BENCH_SPARSE_EXTENT - done : sizeof(_fill);
+
+			if (off + done + n > size)
+				n = size - off - done;
+
+			if ((ret = pwrite(fd, _fill, n, off + done)) < 0)
+				goto _error;
+		}
+	}
+
+	return close(fd);
+
+_error:
+	errsv = errno;
+	close(fd);
+	errno = errsv;
+	return -1;
+}
+
+static int _bench_generate(const struct bench_config *cfg, struct bench_dataset *ds, const char *root) {
+	unsigned long i = 0;
+	int len = 0;
+	char path[BENCH_PATH_MAX];
+
+	if (mkdir(root, 0755) < 0)
+		return -1;
+
+	switch (ds->id) {
+		case BENCH_SET_SMALL: {
+			for (i = 0; i < BENCH_SMALL_DIRS; i ++) {
+				if (_bench_path(path, "%s/d%02lu", root, i) < 0 || mkdir(path, 0755) < 0)
+					return -1;
+			}
+
+			for (i = 0; i < cfg->small_files; i ++) {
+				if (_bench_path(path, "%s/d%02lu/f%06lu", root, i % BENCH_SMALL_DIRS, i) < 0)
+					return -1;
+
+				if (_bench_write(path, BENCH_SMALL_SIZE) < 0)
+					return -1;
+			}
+
+			ds->files = cfg->small_files;
+			ds->bytes = (unsigned long long) cfg->small_files * BENCH_SMALL_SIZE;
+		} break;
+
+		case BENCH_SET_HUGE: {
+			for (i = 0; i < BENCH_HUGE_FILES; i ++) {
+				if (_bench_path(path, "%s/f%lu", root, i) < 0)
+					return -1;
+
+				if (_bench_write(path, (unsigned long long) cfg->huge_mb << 20) < 0)
+					return -1;
+			}
+
+			ds->files = BENCH_HUGE_FILES;
+			ds->bytes = ((unsigned long long) cfg->huge_mb << 20) * BENCH_HUGE_FILES;
+		} break;
+
+		case BENCH_SET_SPARSE: {
+			for (i = 0; i < BENCH_SPARSE_FILES; i ++) {
+				if (_bench_path(path, "%s/f%lu", root, i) < 0)
+					return -1;
+
+				if (_bench_write_sparse(path, (unsigned long long) cfg->sparse_mb << 20) < 0)
+					return -1;
+			}
+
+			ds->files = BENCH_SPARSE_FILES;
+			ds->bytes = ((unsigned long long) cfg->sparse_mb << 20) * BENCH_SPARSE_FILES;
+		} break;
+
+		case BENCH_SET_DEEP: {
+			if ((len = _bench_path(path, "%s", root)) < 0)
+				return -1;
+
+			for (i = 0; i < cfg->depth; i ++) {
+				if (len + 32 >= BENCH_PATH_MAX) {
+					errno = ENAMETOOLONG;
+					return -1;
+				}
+
+				strcpy(path + len, "/f");
+
+				if (_bench_write(path, BENCH_DEEP_SIZE) < 0)
+					return -1;
+
+				len += sprintf(path + len, "/d%lu", i);
+
+				if (mkdir(path, 0755) < 0)
+					return -1;
+			}
+
+			ds->files = cfg->depth;
+			ds->bytes = (unsigned long long) cfg->depth * BENCH_DEEP_SIZE;
+		} break;
+	}
+
+	return 0;
+}
+
+
+static int _bench_dirty(const char *path, off_t off) {
+	int fd = -1, errsv = 0;
+	char buf[BENCH_DIRTY_SIZE];
+
+	memset(buf, 0x5a, sizeof(buf));
+
+	if ((fd = open(path, O_WRONLY)) < 0)
+		return -1;
+
+	if (pwrite(fd, buf, sizeof(buf), off) < 0) {
+		errsv = errno;
+		close(fd);
+		errno = errsv;
+		return -1;
+	}
+
+	return close(fd);
+}
+
+
+/* Runs */
+
+static int _bench_walk_action(int order, struct fsop_walk_entry *entry, void *arg) {
+	if (order != FSOP_WALK_INORDER)
+		return 0;
+
+	(*(unsigned long *) arg) ++;
+
+	if (fsop_walk_entry_type(entry, 0) == FSOP_WALK_TYPE_DIR)
+		return fsop_walkdir_ext(entry->fpath, NULL, &_bench_walk_action, arg);
+
+	return 0;
+}
+
+static int _bench_cp_run(
+		const char *op,
+		const struct bench_dataset *ds,
+		const char *src,
+		const char *dest,
+		const struct fsop_opts *opts)
+{
+	unsigned long i = 0;
+	char spath[BENCH_PATH_MAX], dpath[BENCH_PATH_MAX];
+	struct bench_sample start, end;
+
+	_bench_sample(&start);
+
+	for (i = 0; i < ds->files; i ++) {
+		if (_bench_path(spath, "%s/f%lu", src, i) < 0 || _bench_path(dpath, "%s/f%lu", dest, i) < 0)
+			return -1;
+
+		if (fsop_cp_ext(spath, dpath, opts) < 0)
+			return -1;
+	}
+
+	_bench_sample(&end);
+
+	_bench_report(op, ds, opts->block, 1, fsop_engine_name(fsop_engine_last()), &start, &end, ds->bytes, ds->files);
+
+	return 0;
+}
+
+static int _bench_cp(
+		const struct bench_config *cfg,
+		const struct bench_dataset *ds,
+		const char *src,
+		const char *dest,
+		const struct fsop_opts *opts)
+{
+	unsigned long i = 0;
+	char dpath[BENCH_PATH_MAX];
+	struct fsop_opts prealloc, delta;
+
+	if (mkdir(dest, 0755) < 0)
+		return -1;
+
+	if (_bench_cp_run("cp", ds, src, dest, opts) < 0)
+		return -1;
+
+	/* Each copy replaces the previous one with a new file */
+	prealloc = *opts;
+	prealloc.flags |= FSOP_OPT_PREALLOC;
+
+	if (_bench_cp_run("cpprealloc", ds, src, dest, &prealloc) < 0)
+		return -1;
+
+	/* One block in the middle of each copy differs from its source */
+	for (i = 0; i < ds->files; i ++) {
+		if (_bench_path(dpath, "%s/f%lu", dest, i) < 0)
+			return -1;
+
+		if (_bench_dirty(dpath, ds->bytes / ds->files / 2) < 0)
+			return -1;
+	}
+
+	delta = *opts;
+	delta.flags |= FSOP_OPT_DELTA;
+
+	if (_bench_cp_run("cpdelta", ds, src, dest, &delta) < 0)
+		return -1;
+
+	return fsop_rmdir(dest);
+}
+
+static int _bench_tree(
+		const struct bench_config *cfg,
+		const struct bench_dataset *ds,
+		const char *src,
+		const char *dest,
+		const char *moved,
+		const struct fsop_opts *opts)
+{
+	unsigned long entries = 0;
+	struct bench_sample start, end;
+
+	_bench_sample(&start);
+
+	if (fsop_cpdir_ext(src, dest, opts) < 0)
+		return -1;
+
+	_bench_sample(&end);
+
+	_bench_report("cpdir", ds, opts->block, opts->threads, fsop_engine_name(fsop_engine_last()), &start, &end, ds->bytes, ds->files);
+
+	_bench_sample(&start);
+
+	if (fsop_walkdir_ext(dest, NULL, &_bench_walk_action, &entries) < 0)
+		return -1;
+
+	_bench_sample(&end);
+
+	_bench_report("walkdir", ds, opts->block, 1, "-", &start, &end, 0, entries);
+
+	_bench_sample(&start);
+
+	if (fsop_mvdir_ext(dest, moved, opts) < 0)
+		return -1;
+
+	_bench_sample(&end);
+
+	_bench_report("mvdir", ds, opts->block, opts->threads, "-", &start, &end, ds->bytes, ds->files);
+
+	_bench_sample(&start);
+
+	if (fsop_rmdir_ext(moved, opts) < 0)
+		return -1;
+
+	_bench_sample(&end);
+
+	_bench_report("rmdir", ds, opts->block, opts->threads, "-", &start, &end, 0, entries);
+
+	return 0;
+}
+
+static int _bench_run(const struct bench_config *cfg, struct bench_dataset *ds) {
+	unsigned int b = 0, t = 0, r = 0;
+	char src[BENCH_PATH_MAX], dest[BENCH_PATH_MAX], moved[BENCH_PATH_MAX];
+	struct fsop_opts opts;
+
+	if (_bench_path(src, "%s/%s.src", cfg->workdir, ds->name) < 0 ||
+			_bench_path(dest, "%s/%s.dst", cfg->workdir, ds->name) < 0 ||
+			_bench_path(moved, "%s/%s.mv", cfg->workdir, ds->name) < 0)
+	{
+		fprintf(stderr, "bench: %s\n", strerror(errno));
+		return -1;
+	}
+
+	fprintf(stderr, "bench: generating '%s' dataset...\n", ds->name);
+
+	if (_bench_generate(cfg, ds, src) < 0) {
+		fprintf(stderr, "bench: unable to generate '%s': %s\n", src, strerror(errno));
+		return -1;
+	}
+
+	for (r = 0; r < cfg->repeat; r ++) {
+		for (b = 0; b < cfg->nblocks; b ++) {
+			fsop_opts_init(&opts, cfg->blocks[b]);
+
+			opts.engine = cfg->engine;
+
+			if ((ds->id == BENCH_SET_HUGE || ds->id == BENCH_SET_SPARSE) && _bench_cp(cfg, ds, src, dest, &opts) < 0)
+				goto _error;
+
+			for (t = 0; t < cfg->nthreads; t ++) {
+				opts.threads = cfg->threads[t];
+
+				if (_bench_tree(cfg, ds, src, dest, moved, &opts) < 0)
+					goto _error;
+			}
+		}
+	}
+
+	if (!cfg->keep)
+		fsop_rmdir(src);
+
+	return 0;
+
+_error:
+	fprintf(stderr, "bench: '%s' dataset failed: %s\n", ds->name, strerror(errno));
+
+	return -1;
+}
+
+
+/* Command line */
+
+static unsigned int _bench_list(const char *arg, size_t *sizes, unsigned int *counts) {
+	unsigned int n = 0;
+	char *end = NULL;
+	unsigned long long v = 0;
+
+	while (*arg && n < BENCH_LIST_MAX) {
+		v = strtoull(arg, &end, 10);
+
+		if (end == arg)
+			return 0;
+
+		switch (*end) {
+			case 'k': case 'K': v <<= 10; end ++; break;
+			case 'm': case 'M': v <<= 20; end ++; break;
+		}
+
+		if (!v)
+			return 0;
+
+		if (sizes)
+			sizes[n ++] = v;
+		else
+			counts[n ++] = v;
+
+		if (*end == ',')
+			end ++;
+		else if (*end)
+			return 0;
+
+		arg = end;
+	}
+
+	return n;
+}
+
+static int _bench_sets(const char *arg) {
+	int sets = 0;
+	unsigned int i = 0;
+	size_t len = 0;
+
+	while (*arg) {
+		len = strcspn(arg, ",");
+
+		for (i = 0; _datasets[i].name; i ++) {
+			if (strlen(_datasets[i].name) == len && !strncmp(_datasets[i].name, arg, len))
+				break;
+		}
+
+		if (!_datasets[i].name)
+			return 0;
+
+		sets |= _datasets[i].id;
+		arg += len + !!arg[len];
+	}
+
+	return sets;
+}
+
+static int _bench_engine(const char *arg) {
+	int i = 0;
+
+	for (i = FSOP_ENGINE_AUTO; i <= FSOP_ENGINE_DIRECT; i ++) {
+		if (!strcmp(fsop_engine_name(i), arg))
+			return i;
+	}
+
+	return -1;
+}
+
+static void _bench_usage(const char *prog) {
+	fprintf(stderr,
+		"Usage: %s [options] <workdir>\n"
+		"\n"
+		"  -b <list>    Block sizes (default: 8k,64k,1m)\n"
+		"  -t <list>    Thread counts for tree operations (default: 1,4)\n"
+		"  -s <list>    Datasets: small,huge,sparse,deep (default: all)\n"
+		"  -e <engine>  Copy engine: auto, rdwr, copy_file_range, sendfile,\n"
+		"               splice, clone, io_uring, direct (default: auto)\n"
+		"  -r <count>   Repetitions (default: 1)\n"
+		"  -n <count>   Files in the 'small' dataset (default: %d)\n"
+		"  -m <MiB>     File size of the 'huge' dataset (default: %d)\n"
+		"  -p <MiB>     File size of the 'sparse' dataset (default: %d)\n"
+		"  -d <depth>   Nesting depth of the 'deep' dataset (default: %d)\n"
+		"  -k           Keep the generated datasets\n",
+		prog, BENCH_SMALL_FILES, BENCH_HUGE_MB, BENCH_SPARSE_MB, BENCH_DEEP_DEPTH);
+}
+
+int main(int argc, char *argv[]) {
+	int opt = 0, ret = 0;
+	unsigned int i = 0;
+	struct bench_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	cfg.blocks[0] = 8192;
+	cfg.blocks[1] = 65536;
+	cfg.blocks[2] = 1048576;
+	cfg.nblocks = 3;
+	cfg.threads[0] = 1;
+	cfg.threads[1] = 4;
+	cfg.nthreads = 2;
+	cfg.repeat = 1;
+	cfg.engine = FSOP_ENGINE_AUTO;
+	cfg.sets = BENCH_SET_SMALL | BENCH_SET_HUGE | BENCH_SET_SPARSE | BENCH_SET_DEEP;
+	cfg.small_files = BENCH_SMALL_FILES;
+	cfg.huge_mb = BENCH_HUGE_MB;
+	cfg.sparse_mb = BENCH_SPARSE_MB;
+	cfg.depth = BENCH_DEEP_DEPTH;
+
+	while ((opt = getopt(argc, argv, "b:t:s:e:r:n:m:p:d:k")) != -1) {
+		switch (opt) {
+			case 'b': ret = !(cfg.nblocks = _bench_list(optarg, cfg.blocks, NULL)); break;
+			case 't': ret = !(cfg.nthreads = _bench_list(optarg, NULL, cfg.threads)); break;
+			case 's': ret = !(cfg.sets = _bench_sets(optarg)); break;
+			case 'e': ret = (cfg.engine = _bench_engine(optarg)) < 0; break;
+			case 'r': ret = !(cfg.repeat = strtoul(optarg, NULL, 10)); break;
+			case 'n': ret = !(cfg.small_files = strtoul(optarg, NULL, 10)); break;
+			case 'm': ret = !(cfg.huge_mb = strtoul(optarg, NULL, 10)); break;
+			case 'p': ret = !(cfg.sparse_mb = strtoul(optarg, NULL, 10)); break;
+			case 'd': ret = !(cfg.depth = strtoul(optarg, NULL, 10)); break;
+			case 'k': cfg.keep = 1; break;
+			default: ret = 1;
+		}
+
+		if (ret) {
+			_bench_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		_bench_usage(argv[0]);
+		return 1;
+	}
+
+	cfg.workdir = argv[optind];
+
+	if (mkdir(cfg.workdir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "bench: unable to create '%s': %s\n", cfg.workdir, strerror(errno));
+		return 1;
+	}
+
+	/* Non-zero data, so zero detection doesn't turn copies into holes */
+	memset(_fill, 0xa5, sizeof(_fill));
+
+	_stats = fsop_stats_enable(1) >= 0;
+
+	printf("op,dataset,block,threads,engine,seconds,bytes,files,mb_s,files_s,syscr,syscw,syscalls,allocs,frees,arena_allocs,maxrss_kb\n");
+
+	for (i = 0; _datasets[i].name; i ++) {
+		if (!(cfg.sets & _datasets[i].id))
+			continue;
+
+		if (_bench_run(&cfg, &_datasets[i]) < 0)
+			ret = 1;
+	}
+
+	return ret;
+}
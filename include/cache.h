@@ -0,0 +1,58 @@
+/**
+ * @file cache.h
+ * @brief File System Operations Library (libfsop)
+ *        Path Metadata Cache interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_CACHE_H
+#define FSOP_CACHE_H
+
+#include "config.h"
+#include "path.h"
+
+#ifndef COMPILE_WIN32
+ #define CONFIG_PATH_CACHE	1
+#endif
+
+#ifdef CONFIG_PATH_CACHE
+/*
+ * Metadata cache of fsop_path_info() results, keyed by the path string. It is
+ * split in shards, each one with its own lock, and each shard is a set
+ * associative table with a fixed number of entries, so the cache never grows
+ * past its configured size. Failed lookups of missing paths are cached too.
+ */
+extern volatile int cache_enabled;
+
+int cache_lookup(const char *path, unsigned int mask, int flags, struct fsop_path_info *info);
+void cache_store(const char *path, int flags, const struct fsop_path_info *info);
+void cache_invalidate(const char *path, int tree);
+
+ #define CACHE_INVALIDATE(path)		do { if (cache_enabled) cache_invalidate(path, 0); } while (0)
+ #define CACHE_INVALIDATE_TREE(path)	do { if (cache_enabled) cache_invalidate(path, 1); } while (0)
+#else
+ #define CACHE_INVALIDATE(path)		do { } while (0)
+ #define CACHE_INVALIDATE_TREE(path)	do { } while (0)
+#endif
+
+#endif
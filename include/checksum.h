@@ -0,0 +1,60 @@
+/**
+ * @file checksum.h
+ * @brief File System Operations Library (libfsop)
+ *        Content Checksums interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_CHECKSUM_H
+#define FSOP_CHECKSUM_H
+
+#include <sys/types.h>
+
+#include "config.h"
+
+/*
+ * Streaming checksum state, fed with consecutive pieces of the data. CRC32C
+ * uses the SSE4.2 crc32 instruction when the processor supports it, and a
+ * slicing-by-8 table otherwise. XXH64 is computed with a zero seed.
+ */
+struct checksum {
+	int algo;
+	unsigned long long total;
+	unsigned int crc;
+	unsigned long long v[4];
+	unsigned char mem[32];
+	unsigned int memsize;
+};
+
+int checksum_init(struct checksum *ck, int algo);
+void checksum_update(struct checksum *ck, const void *buf, size_t len);
+unsigned long long checksum_final(const struct checksum *ck);
+
+/*
+ * Feeds 'len' bytes of 'fd' starting at offset 'off', or until end of file is
+ * reached. A negative 'off' reads from the current file offset, and a negative
+ * 'len' reads until end of file.
+ */
+int checksum_fd(struct checksum *ck, int fd, off_t off, off_t len);
+
+#endif
@@ -44,6 +44,17 @@
  #define CONFIG_PATH_MAX    260
 #endif
 
+/* Nanosecond timestamps of a struct stat (Darwin names them differently) */
+#ifdef __APPLE__
+ #define CONFIG_ST_ATIM(st)	((st)->st_atimespec)
+ #define CONFIG_ST_MTIM(st)	((st)->st_mtimespec)
+ #define CONFIG_ST_CTIM(st)	((st)->st_ctimespec)
+#else
+ #define CONFIG_ST_ATIM(st)	((st)->st_atim)
+ #define CONFIG_ST_MTIM(st)	((st)->st_mtim)
+ #define CONFIG_ST_CTIM(st)	((st)->st_ctim)
+#endif
+
 
 #endif
 
@@ -31,6 +31,8 @@
 #include <sys/stat.h>
 
 #include "config.h"
+#include "file.h"
+#include "path.h"
 
 /* Directory Walk Order */
 enum {
@@ -39,13 +41,45 @@ enum {
 	FSOP_WALK_POSTORDER
 };
 
+/* Directory Walk Entry Types */
+enum {
+	FSOP_WALK_TYPE_UNKNOWN = 0,
+	FSOP_WALK_TYPE_FIFO,
+	FSOP_WALK_TYPE_CHR,
+	FSOP_WALK_TYPE_DIR,
+	FSOP_WALK_TYPE_BLK,
+	FSOP_WALK_TYPE_REG,
+	FSOP_WALK_TYPE_LNK,
+	FSOP_WALK_TYPE_SOCK
+};
+
+/* Directory Walk Entry */
+struct fsop_walk_entry {
+	int dirfd;		/* Descriptor of the directory holding the entry */
+	const char *name;	/* Entry name, relative to 'dirfd' */
+	const char *fpath;	/* Full path of the entry */
+	const char *rpath;	/* Path of the entry, relative to the prefix */
+	int type;		/* Entry type (FSOP_WALK_TYPE_*) */
+	ino_t ino;		/* Inode number */
+
+	/* Private */
+	const char *_dir;
+	const char *_prefix;
+	int _cached;
+	struct stat _st;
+#ifndef COMPILE_WIN32
+	struct fsop_path_info _info;
+#endif
+};
+
 
 /* Prototypes / Interface */
 
 /**
  * @brief
  *   Creates the directory described by 'path', making parent directories as
- *   needed.
+ *   needed. Directories that already exist, including the ones concurrently
+ *   created by other threads or processes, are not an error.
  *
  * @param path
  *   New directory path
@@ -109,6 +143,110 @@ int fsop_walkdir(
 			void *arg),
 		void *arg);
 
+/**
+ * @brief
+ *   Same as fsop_walkdir(), but 'action' receives a pointer to an entry
+ *   structure instead of paths. Besides 'fpath' and 'rpath', the entry holds
+ *   its name, its type and inode number as reported by the directory stream
+ *   (so no stat() is required to know them) and the descriptor of the
+ *   directory holding it, which can be used with the *at() family of system
+ *   calls. The type may be FSOP_WALK_TYPE_UNKNOWN on file systems that don't
+ *   report it: use fsop_walk_entry_type() to resolve it. For the
+ *   FSOP_WALK_PREORDER and FSOP_WALK_POSTORDER events, the entry describes the
+ *   directory being walked: 'name' is "." and 'dirfd' is the descriptor of
+ *   that directory. The entry, and the descriptor, are only valid during the
+ *   'action' call.
+ *
+ * @see fsop_walkdir()
+ * @see fsop_walk_entry_stat()
+ * @see fsop_walk_entry_type()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_walkdir_ext(
+		const char *dir,
+		const char *prefix,
+		int (*action)
+			(int order,
+			struct fsop_walk_entry *entry,
+			void *arg),
+		void *arg);
+
+/**
+ * @brief
+ *   Returns the status information of the walk entry 'entry'. The entry is
+ *   only stat'ed on the first call, relative to its directory descriptor.
+ *   Further calls return the cached result.
+ *
+ * @param entry
+ *   The entry received by the fsop_walkdir_ext() action.
+ *
+ * @param follow
+ *   If non-zero and the entry is a symbolic link, the status of the link
+ *   target is returned.
+ *
+ * @return
+ *   On success, a pointer to the entry status is returned. On error, NULL is
+ *   returned and errno is set appropriately.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+const struct stat *fsop_walk_entry_stat(struct fsop_walk_entry *entry, int follow);
+
+/**
+ * @brief
+ *   Returns the type of the walk entry 'entry', querying only the file type
+ *   from the file system when the directory stream didn't report it (or, if
+ *   'follow' is set, when the entry is a symbolic link).
+ *
+ * @param entry
+ *   The entry received by the fsop_walkdir_ext() action.
+ *
+ * @param follow
+ *   If non-zero and the entry is a symbolic link, the type of the link target
+ *   is returned.
+ *
+ * @return
+ *   On success, one of the FSOP_WALK_TYPE_* values is returned. On error, -1
+ *   is returned and errno is set appropriately.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_walk_entry_type(struct fsop_walk_entry *entry, int follow);
+
+#ifndef COMPILE_WIN32
+/**
+ * @brief
+ *   Returns the metadata of the walk entry 'entry', as fsop_path_info() would,
+ *   fetching only the fields in 'mask' (plus the file type). The result is
+ *   cached on the entry, and further calls only query the file system again
+ *   when they request fields that weren't fetched yet.
+ *
+ * @param entry
+ *   The entry received by the fsop_walkdir_ext() action.
+ *
+ * @param mask
+ *   A combination of FSOP_PATH_INFO_* values.
+ *
+ * @param flags
+ *   A combination of FSOP_PATH_NOFOLLOW and FSOP_PATH_DONT_SYNC.
+ *
+ * @return
+ *   On success, a pointer to the entry metadata is returned. On error, NULL is
+ *   returned and errno is set appropriately.
+ *
+ * @see fsop_path_info()
+ *
+ */
+const struct fsop_path_info *fsop_walk_entry_info(struct fsop_walk_entry *entry, unsigned int mask, int flags);
+#endif
+
 /**
  * @brief
  *   Copy the directory and all its contents from path 'src' to path 'dst'.
@@ -132,6 +270,29 @@ DLLIMPORT
 #endif
 int fsop_cpdir(const char *src, const char *dest, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_cpdir(), but the operation is controlled by the options
+ *   structure pointed by 'opts', which are applied to every file copied. When
+ *   the clone mode is set to FSOP_CLONE_AUTO and the source and destination
+ *   trees reside on a file system supporting reflinks, only the metadata is
+ *   effectively copied.
+ *
+ *   If 'threads' is greater than one, directory scans and file copies are
+ *   dispatched to a work stealing pool of that many workers. Each directory is
+ *   created before any of its entries is copied. A failure to copy an entry
+ *   does not stop the remaining copies: -1 is returned at the end and errno is
+ *   set to the error of the first failure.
+ *
+ * @see fsop_cpdir()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_cpdir_ext(const char *src, const char *dest, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Move the directory and all its contents from path 'src' to path 'dst'.
@@ -156,6 +317,21 @@ DLLIMPORT
 #endif
 int fsop_mvdir(const char *src, const char *dest, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_mvdir(), but the copy fallback (used when 'src' and 'dest'
+ *   reside on different file systems) is controlled by the options structure
+ *   pointed by 'opts'.
+ *
+ * @see fsop_mvdir()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_mvdir_ext(const char *src, const char *dest, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Deletes the directory 'dir' and all its contents.
@@ -173,5 +349,26 @@ DLLIMPORT
 #endif
 int fsop_rmdir(const char *dir);
 
+/**
+ * @brief
+ *   Same as fsop_rmdir(), but the operation is controlled by the options
+ *   structure pointed by 'opts'.
+ *
+ *   If 'threads' is greater than one, subdirectories are scanned by a work
+ *   stealing pool of that many workers, each unlinking the entries of its
+ *   directory. A directory is removed as soon as its last subdirectory is
+ *   gone, so the tree is removed bottom-up. A failure to remove an entry does
+ *   not stop the remaining removals: -1 is returned at the end and errno is
+ *   set to the error of the first failure.
+ *
+ * @see fsop_rmdir()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_rmdir_ext(const char *dir, const struct fsop_opts *opts);
+
 #endif
 
@@ -0,0 +1,64 @@
+/**
+ * @file durable.h
+ * @brief File System Operations Library (libfsop)
+ *        Durability interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_DURABLE_H
+#define FSOP_DURABLE_H
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "file.h"
+
+#ifndef COMPILE_WIN32
+ #include <pthread.h>
+#endif
+
+/*
+ * Durability of a whole operation. Like the progress tracker, the outermost
+ * operation with a durability mode set starts a tracker and runs on a copy of
+ * the options pointing to it. Every file written is synced, or only has its
+ * write-out started in batched mode, and the directories holding the entries
+ * created or removed are collected, to be synced once when the operation
+ * ends. All the durable_*() calls are no-ops returning zero when 'opts' has no
+ * tracker.
+ */
+struct durable {
+#ifndef COMPILE_WIN32
+	pthread_mutex_t lock;
+#endif
+	int mode;
+	char **dirs;		/* Hash set of the directories to be synced */
+	size_t size;
+	size_t count;
+};
+
+const struct fsop_opts *durable_begin(struct durable *dg, struct fsop_opts *copy, const struct fsop_opts *opts);
+ssize_t durable_end(struct durable *dg, const struct fsop_opts *opts, ssize_t ret);
+int durable_file(const struct fsop_opts *opts, int fd, const char *path);
+int durable_entry(const struct fsop_opts *opts, const char *path);
+
+#endif
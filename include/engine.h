@@ -0,0 +1,108 @@
+/**
+ * @file engine.h
+ * @brief File System Operations Library (libfsop)
+ *        Copy Engines interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_ENGINE_H
+#define FSOP_ENGINE_H
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "file.h"
+#include "checksum.h"
+
+#if defined(__linux__) && defined(__has_include)
+ #if __has_include(<linux/io_uring.h>)
+  #define CONFIG_URING	1
+ #endif
+#endif
+
+#ifdef __linux__
+ #define CONFIG_DIRECT	1
+#endif
+
+/*
+ * Each engine transfers data from 'sfd' to 'dfd' until end of file is reached,
+ * accumulating the number of transferred bytes in '*count'. On success, zero
+ * is returned. On error, -1 is returned and errno is set appropriately. If
+ * errno is set to a value accepted by engine_refused(), the next engine may
+ * resume the transfer from the current file offsets.
+ */
+int engine_clone(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+int engine_sparse(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+int engine_rdwr(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+#ifndef COMPILE_WIN32
+/* Only writes the blocks that differ from the current contents of 'dfd' */
+int engine_delta(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+#endif
+#ifdef __linux__
+int engine_copy_file_range(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+int engine_sendfile(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+int engine_splice(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+#endif
+#ifdef CONFIG_URING
+int engine_uring(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+#endif
+#ifdef CONFIG_DIRECT
+/* Bypasses the page cache of both files, which must be at aligned offsets */
+int engine_direct(int sfd, int dfd, const struct fsop_opts *opts, size_t *count);
+#endif
+
+int engine_refused(int errsv);
+void engine_last_set(int engine);
+
+/* Data read into userspace buffers by the calling thread is fed to 'ck' */
+void engine_checksum_set(struct checksum *ck);
+struct checksum *engine_checksum_get(void);
+
+/*
+ * Page cache footprint of a transfer in no-cache mode, followed in windows of
+ * the transferred data. The write-out of each window of 'dfd' is started once
+ * it is written, and the windows before it are dropped from the page cache of
+ * both files, while the next window of 'sfd' is read ahead. Without 'drop',
+ * as for batched durability, only the write-out of each window is started.
+ * Ends that are not regular files are left alone.
+ */
+struct engine_stream {
+	int sfd;
+	int dfd;
+	int drop;	/* Whether windows are dropped from the page cache */
+	off_t sbase;	/* Offsets where the transfer started, or -1 */
+	off_t dbase;
+	off_t done;	/* Bytes transferred so far */
+	off_t started;	/* Bytes which write-out was started */
+	off_t dropped;	/* Bytes dropped from the page cache */
+};
+
+void engine_stream_begin(struct engine_stream *es, int sfd, int dfd, int drop);
+void engine_stream_end(struct engine_stream *es);
+
+/* Accounts 'n' transferred bytes, as every engine does after each transfer */
+int engine_progress(const struct fsop_opts *opts, size_t n);
+/* Discounts 'n' bytes of a transfer about to be restarted by another engine */
+void engine_rewind(const struct fsop_opts *opts, size_t n);
+
+#endif
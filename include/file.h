@@ -32,9 +32,276 @@
 
 #include "config.h"
 
+/*
+ * Copy Engines
+ *
+ * FSOP_ENGINE_AUTO tries the in-kernel transfer mechanisms available on the
+ * running system (copy_file_range(), sendfile() and splice()) and falls back
+ * to a userspace read/write loop when the kernel refuses them.
+ *
+ * Any other engine is a preference, not a requirement: when the requested
+ * engine doesn't apply to the files being copied (such as copy_file_range()
+ * on a pipe) or is refused by the kernel or the file system, the transfer
+ * silently falls back to the next engine, down to the read/write loop,
+ * instead of failing. Flags that need the data to pass through userspace
+ * (such as FSOP_OPT_ZERO_HOLES) also take precedence over the requested
+ * engine. Use fsop_engine_last() after a single file operation to find out
+ * which engine actually performed the transfer.
+ *
+ * Requesting FSOP_ENGINE_CLONE is the same as FSOP_CLONE_AUTO with the
+ * default engine.
+ *
+ * FSOP_ENGINE_URING copies regular files through io_uring, keeping 'qdepth'
+ * requests in flight (32 when 'qdepth' is zero), each read being linked to
+ * the write of the same buffer. It is only used when explicitly requested,
+ * or by FSOP_ENGINE_AUTO when 'qdepth' is set and copy_file_range() is
+ * refused. Kernels without io_uring fall back to the remaining engines.
+ *
+ * FSOP_ENGINE_DIRECT is the same as FSOP_OPT_DIRECT.
+ */
+enum {
+	FSOP_ENGINE_AUTO = 0,
+	FSOP_ENGINE_RDWR,
+	FSOP_ENGINE_COPY_FILE_RANGE,
+	FSOP_ENGINE_SENDFILE,
+	FSOP_ENGINE_SPLICE,
+	FSOP_ENGINE_CLONE,
+	FSOP_ENGINE_URING,
+	FSOP_ENGINE_DIRECT
+};
+
+/*
+ * Clone (reflink) Modes
+ *
+ * With FSOP_CLONE_AUTO, regular files are cloned (sharing the source
+ * extents, copy-on-write) whenever the file system supports it, and fully
+ * copied otherwise. FSOP_CLONE_ALWAYS fails the operation if the file cannot
+ * be cloned.
+ */
+enum {
+	FSOP_CLONE_NEVER = 0,
+	FSOP_CLONE_AUTO,
+	FSOP_CLONE_ALWAYS
+};
+
+/*
+ * Durability Modes
+ *
+ * Control how the data written by copies, moves, received files and tree
+ * operations is flushed to stable storage. With FSOP_DURABILITY_NONE,
+ * nothing is flushed. With FSOP_DURABILITY_FILE, each file is flushed with
+ * fdatasync() as soon as it is written. With FSOP_DURABILITY_BATCH, only the
+ * write-out of each file is started while copying, every few megabytes
+ * (sync_file_range() on Linux), and the file systems written are flushed
+ * once, with syncfs(), when the operation ends.
+ *
+ * In both modes, the directories holding the entries created or removed,
+ * including the parents created for tree copies, are synced when the
+ * operation ends, and a failure to flush fails the whole operation. Once the
+ * operation returns, both modes give the same guarantees, but only
+ * FSOP_DURABILITY_FILE ensures that files replaced with FSOP_OPT_ATOMIC never
+ * appear incomplete after a crash while the operation is still running. Not
+ * supported on Windows.
+ */
+enum {
+	FSOP_DURABILITY_NONE = 0,
+	FSOP_DURABILITY_FILE,
+	FSOP_DURABILITY_BATCH
+};
+
+/*
+ * Checksum Algorithms
+ *
+ * When 'checksum' is set, a checksum of the copied data is computed and
+ * stored in '*digest', if 'digest' isn't NULL. Data passing through userspace
+ * buffers is hashed on its way, so FSOP_ENGINE_AUTO copies through the
+ * read/write loop (or direct I/O, if requested). Clones and the in-kernel
+ * transfers of explicitly requested engines are followed by a read of the
+ * copied range of the source, and sources that can't be read again (such as
+ * pipes) are always copied by the read/write loop. As '*digest' is
+ * overwritten by each file, it is only meaningful for single file operations.
+ */
+enum {
+	FSOP_CHECKSUM_NONE = 0,
+	FSOP_CHECKSUM_CRC32C,
+	FSOP_CHECKSUM_XXH64
+};
+
+/* Operation Flags */
+
+/*
+ * FSOP_OPT_SPARSE copies only the data extents of sparse regular files (as
+ * reported by lseek() SEEK_DATA and SEEK_HOLE), keeping the holes in the
+ * destination and preserving its apparent size. FSOP_OPT_ZERO_HOLES turns
+ * every block ('block' bytes) of zeros read from the source into a hole in
+ * the destination. Both flags only apply when the destination is a regular
+ * file.
+ */
+#define FSOP_OPT_SPARSE		0x0001	/* Preserve holes of sparse sources */
+#define FSOP_OPT_ZERO_HOLES	0x0002	/* Turn blocks of zeros into holes */
+
+/*
+ * FSOP_OPT_DONT_SYNC lets tree operations use the attributes cached by
+ * network and FUSE file systems when inspecting entries, instead of
+ * revalidating each one with the server.
+ */
+#define FSOP_OPT_DONT_SYNC	0x0004	/* Accept cached attributes while walking trees */
+
+/*
+ * FSOP_OPT_SYNC turns copies into incremental updates: a regular file is left
+ * untouched when the destination is a regular file with the same size and
+ * modification time, and copied files get the access and modification times
+ * of their source, so the next sync skips them. With FSOP_OPT_SYNC_CONTENT,
+ * files of the same size are compared by content instead of modification
+ * time. With FSOP_OPT_SYNC_DELETE, tree copies also remove the destination
+ * entries that don't exist in the source. Not supported on Windows.
+ */
+#define FSOP_OPT_SYNC		0x0008	/* Skip files already up to date */
+#define FSOP_OPT_SYNC_CONTENT	0x0010	/* Compare contents instead of modification times */
+#define FSOP_OPT_SYNC_DELETE	0x0020	/* Remove destination entries missing from the source */
+
+/*
+ * FSOP_OPT_DELTA updates existing regular destination files in place: the
+ * source is compared to the destination one block ('block' bytes) at a time
+ * and only the blocks that differ are written, so the unchanged extents of
+ * the destination are preserved. The destination is then truncated to the
+ * source size and given the permission bits of the source. As with full
+ * copies, the whole source size is reported as copied, while the
+ * FSOP_STAT_BYTES_REWRITTEN and FSOP_STAT_BYTES_UNCHANGED counters tell the
+ * rewritten blocks from the preserved ones. Destinations that don't exist,
+ * or can't be opened for reading and writing, are copied in full. When
+ * combined with FSOP_OPT_SYNC, only the files found out of date are
+ * compared. Not supported on Windows.
+ */
+#define FSOP_OPT_DELTA		0x0040	/* Rewrite only the blocks that changed */
+
+/*
+ * FSOP_OPT_VERIFY reads back the copied range of regular destination files
+ * and fails the operation with errno set to EIO if its checksum doesn't match
+ * the one of the source ('checksum', or CRC32C if no algorithm is set).
+ * Destination descriptors handed to fsop_fsend_ext() must then be open for
+ * reading.
+ */
+#define FSOP_OPT_VERIFY		0x0080	/* Read copies back and compare their checksums */
+
+/*
+ * FSOP_OPT_ATOMIC makes copies and received files replace their destination
+ * atomically: the data is written to an unnamed O_TMPFILE file (or, where not
+ * supported, to a hidden temporary file) in the destination directory, which
+ * is only linked or renamed over the destination once complete. Readers of
+ * the destination see either the previous or the new contents, and a failed
+ * copy leaves the previous file untouched. When combined with FSOP_OPT_DELTA,
+ * files are copied in full. Not supported on Windows.
+ */
+#define FSOP_OPT_ATOMIC		0x0100	/* Replace destination files only once complete */
+
+/*
+ * FSOP_OPT_PREALLOC reserves the space of regular files with fallocate()
+ * before their data is copied, so file systems can lay each file out in few
+ * extents instead of growing it one write at a time. The destination size is
+ * left unchanged until the data is written. It is skipped for sources copied
+ * as sparse files, with FSOP_OPT_ZERO_HOLES, and wherever fallocate() isn't
+ * supported.
+ */
+#define FSOP_OPT_PREALLOC	0x0200	/* Reserve the space of regular files before copying */
+
+/*
+ * FSOP_OPT_NOCACHE streams copies without leaving their data in the page
+ * cache, so large copies don't evict the working set of other processes.
+ * Sources are read ahead sequentially, the write-out of the destination is
+ * started every few megabytes of copied data, and each range is dropped from
+ * the page cache of both files once written to disk. The data of each file
+ * is thus on disk when its copy returns, although without the metadata flush
+ * of fdatasync().
+ */
+#define FSOP_OPT_NOCACHE	0x0400	/* Keep copied data out of the page cache */
+
+/*
+ * FSOP_OPT_DIRECT, or the FSOP_ENGINE_DIRECT engine, copies regular files
+ * with direct I/O (O_DIRECT), bypassing the page cache entirely. Data is
+ * moved through two page aligned buffers of 'block' bytes (rounded up to a
+ * multiple of 4096), one being filled by a reader thread while the other is
+ * written, so reads and writes overlap. The unaligned tail of each file is
+ * written through the page cache. Large block sizes, of one megabyte or more,
+ * are recommended. Files at unaligned offsets, or on file systems refusing
+ * direct I/O, are copied by the buffered engines instead. Only supported on
+ * Linux.
+ */
+#define FSOP_OPT_DIRECT		0x0800	/* Copy regular files with direct I/O */
+
+/* Buffer Pool Flags */
+#define FSOP_BUFPOOL_HUGEPAGES	0x0001	/* Back large buffers with huge pages */
+
+/* Progress Report */
+struct fsop_progress {
+	unsigned long long bytes;	/* Bytes copied so far */
+	unsigned long long files;	/* Files copied so far */
+	unsigned long long entries;	/* Directory entries processed so far */
+	const char *path;		/* Path being processed, if any */
+	double rate;			/* Bytes per second since the previous report */
+	int done;			/* Set on the last report of the operation */
+};
+
+/* Operation Options */
+struct fsop_opts {
+	size_t block;		/* Block size used on read/write operations */
+	int engine;		/* Preferred copy engine (FSOP_ENGINE_*) */
+	int clone;		/* Clone (reflink) mode (FSOP_CLONE_*) */
+	int flags;		/* Operation flags (FSOP_OPT_*) */
+	unsigned int threads;	/* Worker threads for tree operations, zero to run serially */
+	unsigned int qdepth;	/* Requests in flight for asynchronous engines */
+	int durability;		/* Durability mode (FSOP_DURABILITY_*) */
+
+	/* Progress reporting
+	 *
+	 * When 'progress' is set, it is called with 'progress_arg' as 'arg' every
+	 * 'progress_bytes' bytes copied and every 'progress_entries' directory
+	 * entries processed by tree operations. A zero granularity disables the
+	 * respective reports. Completed files are counted in 'files' and show up
+	 * in the next report. Totals span the whole operation, including all the
+	 * files of a tree, and a final report with 'done' set is issued when the
+	 * operation ends. Reports may come from any worker thread, but never
+	 * concurrently: a report falling due while another one is running is
+	 * merged into the next one. If 'progress' returns non-zero, the operation
+	 * is aborted and fails with errno set to ECANCELED. Setting a byte
+	 * granularity also bounds the size of each in-kernel transfer.
+	 */
+	int (*progress) (const struct fsop_progress *progress, void *arg);
+	void *progress_arg;
+	size_t progress_bytes;		/* Bytes copied between reports */
+	unsigned int progress_entries;	/* Entries processed between reports */
+
+	/* Content checksums */
+	int checksum;			/* Algorithm (FSOP_CHECKSUM_*) */
+	unsigned long long *digest;	/* Checksum of the last file copied */
+
+	/* Private */
+	void *_progress;
+	void *_durable;
+};
+
 
 /* Prototypes / Interface */
 
+/**
+ * @brief
+ *   Initializes the options structure pointed by 'opts' with the default
+ *   values: the FSOP_ENGINE_AUTO engine, the FSOP_CLONE_NEVER clone mode, no
+ *   flags, no durability (FSOP_DURABILITY_NONE), serial tree operations, a
+ *   zero queue depth, and neither progress reports nor checksums.
+ *
+ * @param opts
+ *   The options structure to be initialized.
+ *
+ * @param block
+ *   The block size that will be used on read/write operations.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_opts_init(struct fsop_opts *opts, size_t block);
+
 /**
  * @brief
  *   Copies the file referenced by 'src' to destination 'dest'.
@@ -58,6 +325,20 @@ DLLIMPORT
 #endif
 ssize_t fsop_cp(const char *src, const char *dest, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_cp(), but the operation is controlled by the options
+ *   structure pointed by 'opts'.
+ *
+ * @see fsop_cp()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_cp_ext(const char *src, const char *dest, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Moves the file referenced by 'src' to destination 'dest'.
@@ -81,6 +362,20 @@ DLLIMPORT
 #endif
 ssize_t fsop_mv(const char *from, const char *to, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_mv(), but the operation is controlled by the options
+ *   structure pointed by 'opts'.
+ *
+ * @see fsop_mv()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_mv_ext(const char *from, const char *to, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Receives the contents of a file sent by fsop_fsend(). The contents are
@@ -109,6 +404,20 @@ DLLIMPORT
 #endif
 ssize_t fsop_frecv(int sfd, const char *file, mode_t mode, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_frecv(), but the operation is controlled by the options
+ *   structure pointed by 'opts'.
+ *
+ * @see fsop_frecv()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_frecv_ext(int sfd, const char *file, mode_t mode, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Sends the contents of the file referenced by 'file' to the file descriptor
@@ -133,6 +442,20 @@ DLLIMPORT
 #endif
 ssize_t fsop_fsend(int dfd, const char *file, size_t block);
 
+/**
+ * @brief
+ *   Same as fsop_fsend(), but the operation is controlled by the options
+ *   structure pointed by 'opts'.
+ *
+ * @see fsop_fsend()
+ * @see fsop_opts_init()
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_fsend_ext(int dfd, const char *file, const struct fsop_opts *opts);
+
 /**
  * @brief
  *   Unlinks the file referenced by 'file'.
@@ -150,5 +473,104 @@ DLLIMPORT
 #endif
 int fsop_unlink(const char *file);
 
+/**
+ * @brief
+ *   Computes the checksum of the contents of the file referenced by 'file'.
+ *   Regular files are mapped into memory, and must not be truncated while
+ *   being hashed. Other files are read until end of file.
+ *
+ * @param file
+ *   The file to be hashed.
+ *
+ * @param algo
+ *   One of the FSOP_CHECKSUM_* algorithms, other than FSOP_CHECKSUM_NONE.
+ *
+ * @param digest
+ *   Where the checksum is stored. CRC32C checksums take the lower 32 bits.
+ *
+ * @return
+ *   On success, zero is returned. On error, -1 is returned and errno is set
+ *   appropriately.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_checksum(const char *file, int algo, unsigned long long *digest);
+
+/**
+ * @brief
+ *   Configures the pool of copy buffers shared by all the copy operations.
+ *   Buffers are page aligned, which also satisfies the alignment requirements
+ *   of direct I/O, and are returned to the pool when an operation completes,
+ *   so consecutive copies (such as the files of a fsop_cpdir() call) don't
+ *   allocate their own. Any buffers currently cached are released. By
+ *   default, up to 16 buffers are cached and each buffer is sized after the
+ *   block size of the operation that first requested it.
+ *
+ * @param count
+ *   Maximum number of buffers kept in the pool. Zero disables caching.
+ *
+ * @param size
+ *   Minimum buffer size. Smaller requests are rounded up to this size, so
+ *   buffers can be shared by operations using different block sizes.
+ *
+ * @param flags
+ *   If FSOP_BUFPOOL_HUGEPAGES is set, buffers of 2 MiB or more are backed by
+ *   huge pages, when available.
+ *
+ * @return
+ *   On success, zero is returned. On error, -1 is returned and errno is set
+ *   appropriately.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_bufpool_config(unsigned int count, size_t size, int flags);
+
+/**
+ * @brief
+ *   Releases all the buffers currently cached by the copy buffer pool.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_bufpool_flush(void);
+
+/**
+ * @brief
+ *   Returns the copy engine that completed the last data transfer performed by
+ *   the calling thread. This is the supported way to detect that a requested
+ *   engine was refused and another one took over. Files copied by the worker
+ *   threads of tree operations are not reflected here.
+ *
+ * @return
+ *   One of the FSOP_ENGINE_* values. If no transfer was yet performed by the
+ *   calling thread, FSOP_ENGINE_AUTO is returned.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_engine_last(void);
+
+/**
+ * @brief
+ *   Returns a printable name for the copy engine 'engine'.
+ *
+ * @param engine
+ *   One of the FSOP_ENGINE_* values.
+ *
+ * @return
+ *   A pointer to a static string describing the engine.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+const char *fsop_engine_name(int engine);
+
 #endif
 
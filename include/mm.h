@@ -28,6 +28,8 @@
 #ifndef FSOP_MM_H
 #define FSOP_MM_H
 
+#include <stddef.h>
+
 #ifdef USE_LIBFSMA
  #include <fsma/fsma.h>
 #endif
@@ -37,4 +39,43 @@ void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
 void *mm_calloc(size_t nmemb, size_t size);
 
+/*
+ * Arena (bump) allocator, for transient allocations with a stack like
+ * lifetime. Memory is taken from large chunks and returned in bulk, by
+ * rewinding the arena to a previously taken mark, or by resetting it.
+ */
+struct mm_arena;
+
+struct mm_arena_mark {
+	void *chunk;
+	size_t used;
+};
+
+struct mm_arena *mm_arena_create(size_t chunk);
+void mm_arena_destroy(struct mm_arena *arena);
+void *mm_arena_alloc(struct mm_arena *arena, size_t size);
+void mm_arena_mark(struct mm_arena *arena, struct mm_arena_mark *mark);
+void mm_arena_release(struct mm_arena *arena, const struct mm_arena_mark *mark);
+void mm_arena_reset(struct mm_arena *arena);
+struct mm_arena *mm_arena_thread(void);
+
+/*
+ * Pool of page aligned buffers, shared by all threads, for the data path of
+ * copy operations. Buffers are returned to the pool by mm_buf_put() and handed
+ * out again to any request of the same or smaller size.
+ */
+enum {
+	MM_BUF_HEAP = 0,
+	MM_BUF_MMAP
+};
+
+struct mm_buf {
+	void *ptr;
+	size_t size;
+	int kind;
+};
+
+int mm_buf_get(struct mm_buf *buf, size_t size);
+void mm_buf_put(struct mm_buf *buf);
+
 #endif
@@ -30,9 +30,46 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "config.h"
 
+/* Fields of struct fsop_path_info (same values as the statx() STATX_* bits) */
+#define FSOP_PATH_INFO_TYPE	0x0001	/* File type bits of 'mode' */
+#define FSOP_PATH_INFO_MODE	0x0002	/* Permission bits of 'mode' */
+#define FSOP_PATH_INFO_NLINK	0x0004
+#define FSOP_PATH_INFO_UID	0x0008
+#define FSOP_PATH_INFO_GID	0x0010
+#define FSOP_PATH_INFO_ATIME	0x0020
+#define FSOP_PATH_INFO_MTIME	0x0040
+#define FSOP_PATH_INFO_CTIME	0x0080
+#define FSOP_PATH_INFO_INO	0x0100
+#define FSOP_PATH_INFO_SIZE	0x0200
+#define FSOP_PATH_INFO_BLOCKS	0x0400
+#define FSOP_PATH_INFO_ALL	0x07ff
+
+/* Query flags */
+#define FSOP_PATH_NOFOLLOW	0x0001	/* Describe symbolic links themselves */
+#define FSOP_PATH_DONT_SYNC	0x0002	/* Accept cached attributes of network file systems */
+
+#ifndef COMPILE_WIN32
+struct fsop_path_info {
+	unsigned int mask;	/* FSOP_PATH_INFO_* fields filled in */
+	int error;		/* errno of a failed batch query, 0 otherwise */
+	mode_t mode;
+	nlink_t nlink;
+	uid_t uid;
+	gid_t gid;
+	ino_t ino;
+	dev_t dev;
+	off_t size;
+	blkcnt_t blocks;
+	struct timespec atime;
+	struct timespec mtime;
+	struct timespec ctime;
+};
+#endif
+
 /* Prototypes / Interface */
 
 /**
@@ -314,6 +351,127 @@ uid_t fsop_path_owner(const char *path);
  */
 gid_t fsop_path_group(const char *path);
 
+/**
+ * @brief
+ *   Retrieves the metadata of 'path' with a single system call. Only the
+ *   fields requested in 'mask' are guaranteed to be filled, which lets the
+ *   file system skip the work of fetching the others (statx() is used where
+ *   available). The remaining fields may be filled as well, as reported by
+ *   'info->mask'.
+ *
+ * @param path
+ *   The path to be queried.
+ *
+ * @param mask
+ *   A combination of FSOP_PATH_INFO_* values. Zero only checks that the path
+ *   exists.
+ *
+ * @param flags
+ *   A combination of FSOP_PATH_NOFOLLOW, to describe a symbolic link instead
+ *   of the element it points to, and FSOP_PATH_DONT_SYNC, to accept whatever
+ *   attributes are cached locally instead of revalidating them with the
+ *   server (network and FUSE file systems, where statx() is available).
+ *
+ * @param info
+ *   The structure to be filled.
+ *
+ * @return
+ *   On success, 0 is returned. On error, -1 is returned and errno is set
+ *   appropriately.
+ *
+ */
+int fsop_path_info(const char *path, unsigned int mask, int flags, struct fsop_path_info *info);
+
+/**
+ * @brief
+ *   Same as fsop_path_info(), but a relative 'path' is resolved against the
+ *   directory referred by the descriptor 'dirfd' (AT_FDCWD for the current
+ *   working directory).
+ *
+ * @see fsop_path_info()
+ *
+ */
+int fsop_path_info_at(int dirfd, const char *path, unsigned int mask, int flags, struct fsop_path_info *info);
+
+/**
+ * @brief
+ *   Batch form of fsop_path_info(). Each of the 'count' paths in 'paths' is
+ *   described in the respective element of 'info'. Relative paths are
+ *   resolved against the directory 'dir', which is only looked up once for
+ *   the whole batch.
+ *
+ * @param dir
+ *   The base directory for relative paths, or NULL for the current working
+ *   directory.
+ *
+ * @param paths
+ *   The paths to be queried.
+ *
+ * @param count
+ *   The number of elements of 'paths' and 'info'.
+ *
+ * @param mask
+ *   A combination of FSOP_PATH_INFO_* values.
+ *
+ * @param flags
+ *   A combination of FSOP_PATH_NOFOLLOW and FSOP_PATH_DONT_SYNC.
+ *
+ * @param info
+ *   The structures to be filled. The ones of paths that couldn't be queried
+ *   have a zero 'mask' and the reason in 'error'.
+ *
+ * @return
+ *   The number of paths successfully queried. If 'dir' can't be opened, -1 is
+ *   returned and errno is set appropriately.
+ *
+ */
+ssize_t fsop_path_info_batch(const char *dir, const char **paths, size_t count, unsigned int mask, int flags, struct fsop_path_info *info);
+
+/**
+ * @brief
+ *   Configures the path metadata cache, which is disabled by default. While
+ *   enabled, fsop_path_info() and all the predicates above (fsop_path_exists(),
+ *   fsop_path_isdir(), ...) answer repeated queries of the same path from the
+ *   cache, including queries of missing paths, until the entry is 'ttl'
+ *   milliseconds old. Entries are keyed by the path string as given, so
+ *   relative paths assume the working directory doesn't change. The library
+ *   operations that modify paths (fsop_cp(), fsop_mv(), fsop_unlink(),
+ *   fsop_pmkdir(), fsop_rmdir(), ...) invalidate the affected entries; changes
+ *   made by any other means must be reported with
+ *   fsop_path_cache_invalidate(), or will only be seen once the entries
+ *   expire. Reconfiguring the cache drops all the cached entries.
+ *
+ * @param entries
+ *   The maximum number of cached entries, or zero to disable the cache and
+ *   release its memory.
+ *
+ * @param ttl
+ *   The lifetime of each entry, in milliseconds.
+ *
+ * @return
+ *   On success, 0 is returned. On error, -1 is returned and errno is set
+ *   appropriately.
+ *
+ */
+int fsop_path_cache_config(unsigned int entries, unsigned int ttl);
+
+/**
+ * @brief
+ *   Removes 'path', and every path below it, from the path metadata cache.
+ *
+ * @param path
+ *   The path to be invalidated.
+ *
+ */
+void fsop_path_cache_invalidate(const char *path);
+
+/**
+ * @brief
+ *   Removes all the entries of the path metadata cache.
+ *
+ */
+void fsop_path_cache_flush(void);
+
 #endif
 
 #endif
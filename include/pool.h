@@ -0,0 +1,51 @@
+/**
+ * @file pool.h
+ * @brief File System Operations Library (libfsop)
+ *        Worker Pool interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_POOL_H
+#define FSOP_POOL_H
+
+#include "config.h"
+
+#ifndef COMPILE_WIN32
+ #define CONFIG_POOL	1
+#endif
+
+#ifdef CONFIG_POOL
+struct pool;
+
+/*
+ * Work stealing pool. Each worker owns a deque: tasks submitted from inside a
+ * worker are pushed to, and popped from, the tail of its own deque (depth
+ * first), while idle workers steal from the head of the other deques.
+ */
+struct pool *pool_create(unsigned int workers);
+int pool_submit(struct pool *pool, void (*fn) (void *arg), void *arg);
+void pool_wait(struct pool *pool);
+void pool_destroy(struct pool *pool);
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file progress.h
+ * @brief File System Operations Library (libfsop)
+ *        Progress Reporting interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_PROGRESS_H
+#define FSOP_PROGRESS_H
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "file.h"
+
+/*
+ * Progress of a whole operation. The outermost operation with a progress
+ * callback set starts a tracker and runs on a copy of the options pointing to
+ * it, so nested operations (the files of a tree copy) add to the same totals.
+ * Counters are updated atomically by the worker threads, and the callback is
+ * invoked without any lock held by whichever thread wins the 'reporting' flag.
+ * Reports that fall due while another one is running are merged into the next.
+ * All the progress_*() calls below are no-ops returning zero when 'opts' has
+ * no tracker, and return -1 with errno set to ECANCELED once the callback
+ * asked for the operation to be aborted.
+ */
+struct progress {
+	const struct fsop_opts *opts;
+	unsigned long long bytes;	/* Bytes copied so far */
+	unsigned long long files;	/* Files copied so far */
+	unsigned long long entries;	/* Entries processed so far */
+	long long pending_bytes;	/* Bytes not yet reported */
+	long long pending_entries;	/* Entries not yet reported */
+	unsigned long long rewound;	/* Bytes rewound since the previous report */
+	int reporting;			/* Set while a report is being issued */
+	int cancelled;
+
+	/* Only accessed by the thread holding 'reporting' */
+	struct fsop_progress report;
+	unsigned long long last_bytes;	/* Total bytes at the previous report */
+	unsigned long long last_time;	/* Time of the previous report, in ns */
+};
+
+const struct fsop_opts *progress_begin(struct progress *pg, struct fsop_opts *copy, const struct fsop_opts *opts);
+ssize_t progress_end(struct progress *pg, const struct fsop_opts *opts, ssize_t ret);
+void progress_path(const struct fsop_opts *opts, const char *path);
+int progress_bytes(const struct fsop_opts *opts, size_t n);
+void progress_rewind(const struct fsop_opts *opts, size_t n);
+int progress_file(const struct fsop_opts *opts);
+int progress_entry(const struct fsop_opts *opts, const char *path);
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * @file stats.h
+ * @brief File System Operations Library (libfsop)
+ *        Statistics interface header
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FSOP_STATS_H
+#define FSOP_STATS_H
+
+#include "config.h"
+
+/* Building with -DFSOP_NO_STATS compiles all the instrumentation out */
+#ifndef FSOP_NO_STATS
+ #define CONFIG_STATS	1
+#endif
+
+/* Counters */
+enum {
+	/* Data transfers */
+	FSOP_STAT_BYTES = 0,		/* Bytes copied */
+	FSOP_STAT_FILES,		/* Files copied */
+	FSOP_STAT_FILES_SKIPPED,	/* Files left untouched by sync mode */
+	FSOP_STAT_BYTES_UNCHANGED,	/* Bytes left untouched by delta copies */
+	FSOP_STAT_BYTES_REWRITTEN,	/* Bytes rewritten by delta copies */
+	FSOP_STAT_BYTES_HASHED,		/* Bytes read back to compute checksums */
+
+	/* Copy engine that completed each transfer (same order as FSOP_ENGINE_*) */
+	FSOP_STAT_ENGINE_RDWR,
+	FSOP_STAT_ENGINE_COPY_FILE_RANGE,
+	FSOP_STAT_ENGINE_SENDFILE,
+	FSOP_STAT_ENGINE_SPLICE,
+	FSOP_STAT_ENGINE_CLONE,
+	FSOP_STAT_ENGINE_URING,
+	FSOP_STAT_ENGINE_DIRECT,
+
+	/* System calls */
+	FSOP_STAT_SYS_OPEN,
+	FSOP_STAT_SYS_CLOSE,
+	FSOP_STAT_SYS_READ,
+	FSOP_STAT_SYS_WRITE,
+	FSOP_STAT_SYS_SEEK,
+	FSOP_STAT_SYS_STAT,
+	FSOP_STAT_SYS_GETDENTS,
+	FSOP_STAT_SYS_MKDIR,
+	FSOP_STAT_SYS_RMDIR,
+	FSOP_STAT_SYS_UNLINK,
+	FSOP_STAT_SYS_RENAME,
+	FSOP_STAT_SYS_TRUNCATE,
+	FSOP_STAT_SYS_FALLOCATE,
+	FSOP_STAT_SYS_CLONE,
+	FSOP_STAT_SYS_COPY_FILE_RANGE,
+	FSOP_STAT_SYS_SENDFILE,
+	FSOP_STAT_SYS_SPLICE,
+	FSOP_STAT_SYS_URING,
+	FSOP_STAT_SYS_SYNC,
+	FSOP_STAT_SYS_FADVISE,
+
+	/* Directory walks */
+	FSOP_STAT_WALK_DIRS,		/* Directories scanned */
+	FSOP_STAT_WALK_ENTRIES,		/* Entries reported */
+
+	/* Memory */
+	FSOP_STAT_ALLOCS,		/* Heap allocations */
+	FSOP_STAT_FREES,		/* Heap releases */
+	FSOP_STAT_ARENA_ALLOCS,		/* Arena allocations */
+	FSOP_STAT_BUFPOOL_HITS,		/* Copy buffers reused from the pool */
+	FSOP_STAT_BUFPOOL_MISSES,	/* Copy buffers allocated */
+
+	/* Time spent on each phase, in nanoseconds */
+	FSOP_STAT_TIME_COPY,		/* Data transfers */
+	FSOP_STAT_TIME_SCAN,		/* Directory reads */
+	FSOP_STAT_TIME_MKDIR,		/* Directory creation */
+
+	FSOP_STAT_MAX
+};
+
+struct fsop_stats {
+	unsigned long long value[FSOP_STAT_MAX];
+};
+
+
+/* Prototypes */
+
+/**
+ * @brief
+ *   Enables or disables the collection of statistics. Collection is disabled
+ *   by default, and while disabled each instrumented point costs a single
+ *   branch. Counters are kept per thread and merged on fsop_stats_get(), so
+ *   collecting them doesn't add contention between threads.
+ *
+ * @param enable
+ *   Non-zero to enable collection, zero to disable it.
+ *
+ * @return
+ *   The previous state. If the library was built with FSOP_NO_STATS, -1 is
+ *   returned and errno is set to ENOSYS.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_stats_enable(int enable);
+
+/**
+ * @brief
+ *   Merges the counters of all threads, including the ones that already
+ *   exited, into the structure pointed by 'stats'. Counters start from the
+ *   last call to fsop_stats_reset().
+ *
+ * @param stats
+ *   The structure to be filled. Use the FSOP_STAT_* constants as indexes of
+ *   its 'value' array.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_stats_get(struct fsop_stats *stats);
+
+/**
+ * @brief
+ *   Resets all counters to zero.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_stats_reset(void);
+
+/**
+ * @brief
+ *   Returns a short name for the counter 'counter' (such as "sys_read"),
+ *   suitable for reports.
+ *
+ * @param counter
+ *   One of FSOP_STAT_*.
+ *
+ * @return
+ *   The counter name, or NULL if 'counter' isn't valid.
+ *
+ */
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+const char *fsop_stats_name(int counter);
+
+
+/* Library internals */
+#ifdef CONFIG_STATS
+extern volatile int stats_enabled;
+
+void stats_add(int counter, unsigned long long n);
+unsigned long long stats_clock(void);
+
+ #define STATS_ADD(counter, n)		do { if (__builtin_expect(stats_enabled, 0)) stats_add(counter, n); } while (0)
+ #define STATS_TIME_START(t)		do { if (__builtin_expect(stats_enabled, 0)) t = stats_clock(); } while (0)
+ #define STATS_TIME_STOP(t, counter)	do { if (__builtin_expect(stats_enabled, 0) && t) stats_add(counter, stats_clock() - t); } while (0)
+#else
+ #define STATS_ADD(counter, n)		do { } while (0)
+ #define STATS_TIME_START(t)		do { (void) (t); } while (0)
+ #define STATS_TIME_STOP(t, counter)	do { (void) (t); } while (0)
+#endif
+
+#define STATS_INC(counter)		STATS_ADD(counter, 1)
+
+#endif
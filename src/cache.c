@@ -0,0 +1,331 @@
+/**
+ * @file cache.c
+ * @brief File System Operations Library (libfsop)
+ *        Path Metadata Cache interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "config.h"
+#include "mm.h"
+#include "path.h"
+#include "cache.h"
+
+#ifdef CONFIG_PATH_CACHE
+#include <pthread.h>
+
+#define CACHE_SHARDS		16
+#define CACHE_WAYS		4
+
+struct _cache_entry {
+	unsigned long long hash;	/* Zero when the entry is free */
+	unsigned long long expires;
+	int flags;
+	char *path;
+	struct fsop_path_info info;
+};
+
+struct _cache_shard {
+	pthread_mutex_t lock;
+	struct _cache_entry *slots;
+	unsigned int nsets;
+} __attribute__ ((aligned (64)));
+
+volatile int cache_enabled = 0;
+
+static unsigned long long _cache_ttl = 0;
+static struct _cache_shard _cache_shards[CACHE_SHARDS];
+static pthread_mutex_t _cache_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _cache_once = PTHREAD_ONCE_INIT;
+
+static void _cache_init(void) {
+	int i = 0;
+
+	for (i = 0; i < CACHE_SHARDS; i ++)
+		pthread_mutex_init(&_cache_shards[i].lock, NULL);
+}
+
+static unsigned long long _cache_clock(void) {
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long _cache_hash(const char *path, int flags) {
+	unsigned long long h = 14695981039346656037ULL;
+
+	/* FNV-1a */
+	for ( ; *path; path ++)
+		h = (h ^ (unsigned char) *path) * 1099511628211ULL;
+
+	h = (h ^ (unsigned int) flags) * 1099511628211ULL;
+
+	return h ? h : 1;
+}
+
+static struct _cache_entry *_cache_set(unsigned long long hash, struct _cache_shard **shard) {
+	*shard = &_cache_shards[hash % CACHE_SHARDS];
+
+	if (!(*shard)->slots)
+		return NULL;
+
+	return &(*shard)->slots[((hash / CACHE_SHARDS) % (*shard)->nsets) * CACHE_WAYS];
+}
+
+static void _cache_drop(struct _cache_entry *e) {
+	mm_free(e->path);
+
+	memset(e, 0, sizeof(struct _cache_entry));
+}
+
+/* Must be called with the shard locked */
+static void _cache_shard_flush(struct _cache_shard *shard) {
+	unsigned int i = 0;
+
+	if (!shard->slots)
+		return;
+
+	for (i = 0; i < shard->nsets * CACHE_WAYS; i ++) {
+		if (shard->slots[i].hash)
+			_cache_drop(&shard->slots[i]);
+	}
+}
+
+int cache_lookup(const char *path, unsigned int mask, int flags, struct fsop_path_info *info) {
+	int i = 0, hit = 0;
+	unsigned long long hash = 0;
+	struct _cache_shard *shard = NULL;
+	struct _cache_entry *set = NULL;
+
+	flags &= FSOP_PATH_NOFOLLOW;
+	hash = _cache_hash(path, flags);
+
+	pthread_mutex_lock(&_cache_shards[hash % CACHE_SHARDS].lock);
+
+	if (!(set = _cache_set(hash, &shard)))
+		goto _finish;
+
+	for (i = 0; i < CACHE_WAYS; i ++) {
+		if (set[i].hash != hash || set[i].flags != flags || strcmp(set[i].path, path))
+			continue;
+
+		if (set[i].expires <= _cache_clock()) {
+			_cache_drop(&set[i]);
+			break;
+		}
+
+		/* Missing paths satisfy any mask */
+		if (!set[i].info.error && (mask & ~set[i].info.mask))
+			break;
+
+		memcpy(info, &set[i].info, sizeof(struct fsop_path_info));
+		hit = 1;
+
+		break;
+	}
+
+_finish:
+	pthread_mutex_unlock(&shard->lock);
+
+	return hit;
+}
+
+void cache_store(const char *path, int flags, const struct fsop_path_info *info) {
+	int i = 0;
+	char *copy = NULL;
+	size_t len = strlen(path) + 1;
+	unsigned long long hash = 0;
+	struct _cache_shard *shard = NULL;
+	struct _cache_entry *set = NULL, *e = NULL;
+
+	flags &= FSOP_PATH_NOFOLLOW;
+	hash = _cache_hash(path, flags);
+
+	/* Allocated before locking the shard, and simply not cached on failure */
+	if (!(copy = mm_alloc(len)))
+		return;
+
+	memcpy(copy, path, len);
+
+	pthread_mutex_lock(&_cache_shards[hash % CACHE_SHARDS].lock);
+
+	if (!(set = _cache_set(hash, &shard))) {
+		pthread_mutex_unlock(&shard->lock);
+		mm_free(copy);
+		return;
+	}
+
+	/* Same path, else a free way, else the way closest to expire */
+	for (i = 0, e = &set[0]; i < CACHE_WAYS; i ++) {
+		if (set[i].hash == hash && set[i].flags == flags && !strcmp(set[i].path, path)) {
+			e = &set[i];
+			break;
+		}
+
+		if (e->hash && (!set[i].hash || set[i].expires < e->expires))
+			e = &set[i];
+	}
+
+	if (e->hash)
+		_cache_drop(e);
+
+	e->hash = hash;
+	e->expires = _cache_clock() + _cache_ttl;
+	e->flags = flags;
+	e->path = copy;
+
+	memcpy(&e->info, info, sizeof(struct fsop_path_info));
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void cache_invalidate(const char *path, int tree) {
+	int i = 0;
+	unsigned int j = 0;
+	size_t len = strlen(path);
+	unsigned long long hash = 0;
+	struct _cache_shard *shard = NULL;
+	struct _cache_entry *set = NULL;
+
+	if (tree) {
+		/* Everything below 'path' may be cached on any shard */
+		for (i = 0; i < CACHE_SHARDS; i ++) {
+			shard = &_cache_shards[i];
+
+			pthread_mutex_lock(&shard->lock);
+
+			for (j = 0; shard->slots && j < shard->nsets * CACHE_WAYS; j ++) {
+				if (!shard->slots[j].hash || strncmp(shard->slots[j].path, path, len))
+					continue;
+
+				if (!shard->slots[j].path[len] || shard->slots[j].path[len] == '/')
+					_cache_drop(&shard->slots[j]);
+			}
+
+			pthread_mutex_unlock(&shard->lock);
+		}
+
+		return;
+	}
+
+	/* Both the followed and the not followed entries of the path */
+	for (i = 0; i <= FSOP_PATH_NOFOLLOW; i += FSOP_PATH_NOFOLLOW) {
+		hash = _cache_hash(path, i);
+
+		pthread_mutex_lock(&_cache_shards[hash % CACHE_SHARDS].lock);
+
+		if ((set = _cache_set(hash, &shard))) {
+			for (j = 0; j < CACHE_WAYS; j ++) {
+				if (set[j].hash == hash && !strcmp(set[j].path, path))
+					_cache_drop(&set[j]);
+			}
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+int fsop_path_cache_config(unsigned int entries, unsigned int ttl) {
+	int i = 0, errsv = 0;
+	unsigned int nsets = 0;
+	struct _cache_entry *slots[CACHE_SHARDS], *old = NULL;
+
+	pthread_once(&_cache_once, &_cache_init);
+
+	memset(slots, 0, sizeof(slots));
+
+	/* Entries are evenly split across the shards, rounded up to whole sets */
+	if (entries) {
+		nsets = (entries + CACHE_SHARDS * CACHE_WAYS - 1) / (CACHE_SHARDS * CACHE_WAYS);
+
+		for (i = 0; i < CACHE_SHARDS; i ++) {
+			if (!(slots[i] = mm_calloc(nsets * CACHE_WAYS, sizeof(struct _cache_entry))))
+				goto _error;
+		}
+	}
+
+	pthread_mutex_lock(&_cache_config_lock);
+
+	cache_enabled = 0;
+
+	_cache_ttl = (unsigned long long) ttl * 1000000ULL;
+
+	for (i = 0; i < CACHE_SHARDS; i ++) {
+		pthread_mutex_lock(&_cache_shards[i].lock);
+
+		_cache_shard_flush(&_cache_shards[i]);
+
+		old = _cache_shards[i].slots;
+
+		_cache_shards[i].slots = slots[i];
+		_cache_shards[i].nsets = nsets;
+
+		pthread_mutex_unlock(&_cache_shards[i].lock);
+
+		mm_free(old);
+	}
+
+	cache_enabled = !!entries;
+
+	pthread_mutex_unlock(&_cache_config_lock);
+
+	return 0;
+
+_error:
+	errsv = errno;
+
+	for (i = 0; i < CACHE_SHARDS; i ++)
+		mm_free(slots[i]);
+
+	errno = errsv;
+
+	return -1;
+}
+
+void fsop_path_cache_invalidate(const char *path) {
+	if (cache_enabled)
+		cache_invalidate(path, 1);
+}
+
+void fsop_path_cache_flush(void) {
+	int i = 0;
+
+	if (!cache_enabled)
+		return;
+
+	for (i = 0; i < CACHE_SHARDS; i ++) {
+		pthread_mutex_lock(&_cache_shards[i].lock);
+		_cache_shard_flush(&_cache_shards[i]);
+		pthread_mutex_unlock(&_cache_shards[i].lock);
+	}
+}
+#endif
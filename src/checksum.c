@@ -0,0 +1,445 @@
+/**
+ * @file checksum.c
+ * @brief File System Operations Library (libfsop)
+ *        Content Checksums interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifndef COMPILE_WIN32
+ #include <sys/mman.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+ #include <nmmintrin.h>
+ #define CONFIG_CRC32C_SSE42	1
+#endif
+
+#include "mm.h"
+#include "file.h"
+#include "stats.h"
+#include "checksum.h"
+
+/* Size of the reads issued when hashing file contents */
+#define CHECKSUM_READ_SIZE	(1UL << 20)
+
+/* Size of each mapping used by fsop_checksum() */
+#define CHECKSUM_MAP_SIZE	(1UL << 28)
+
+#define CRC32C_POLY		0x82f63b78
+
+#define XXH64_P1		11400714785074694791ULL
+#define XXH64_P2		14029467366897019727ULL
+#define XXH64_P3		1609587929392839161ULL
+#define XXH64_P4		9650029242287828579ULL
+#define XXH64_P5		2870177450012600261ULL
+
+static uint32_t _crc32c_table[8][256];
+
+#ifdef CONFIG_CRC32C_SSE42
+static int _crc32c_sse42 = 0;
+#endif
+
+static void __attribute__ ((constructor)) _checksum_init(void) {
+	int i = 0, j = 0;
+	uint32_t crc = 0;
+
+	for (i = 0; i < 256; i ++) {
+		for (crc = i, j = 0; j < 8; j ++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+		_crc32c_table[0][i] = crc;
+	}
+
+	/* Slicing-by-8 tables */
+	for (i = 0; i < 256; i ++) {
+		for (crc = _crc32c_table[0][i], j = 1; j < 8; j ++) {
+			crc = _crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			_crc32c_table[j][i] = crc;
+		}
+	}
+
+#ifdef CONFIG_CRC32C_SSE42
+	__builtin_cpu_init();
+
+	_crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint64_t _checksum_le64(const unsigned char *p) {
+	return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+		(uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint32_t _checksum_le32(const unsigned char *p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint32_t _crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t w = 0;
+
+	for ( ; len >= 8; p += 8, len -= 8) {
+		w = _checksum_le64(p) ^ crc;
+
+		crc = _crc32c_table[7][w & 0xff] ^ _crc32c_table[6][(w >> 8) & 0xff] ^
+			_crc32c_table[5][(w >> 16) & 0xff] ^ _crc32c_table[4][(w >> 24) & 0xff] ^
+			_crc32c_table[3][(w >> 32) & 0xff] ^ _crc32c_table[2][(w >> 40) & 0xff] ^
+			_crc32c_table[1][(w >> 48) & 0xff] ^ _crc32c_table[0][w >> 56];
+	}
+
+	for ( ; len; p ++, len --)
+		crc = _crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef CONFIG_CRC32C_SSE42
+static uint32_t __attribute__ ((target ("sse4.2"))) _crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+	uint32_t w32 = 0;
+ #ifdef __x86_64__
+	uint64_t crc64 = crc, w = 0;
+
+	for ( ; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		crc64 = _mm_crc32_u64(crc64, w);
+	}
+
+	crc = (uint32_t) crc64;
+ #endif
+
+	for ( ; len >= 4; p += 4, len -= 4) {
+		memcpy(&w32, p, 4);
+		crc = _mm_crc32_u32(crc, w32);
+	}
+
+	for ( ; len; p ++, len --)
+		crc = _mm_crc32_u8(crc, *p);
+
+	return crc;
+}
+#endif
+
+static uint64_t _xxh64_rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t _xxh64_round(uint64_t acc, uint64_t input) {
+	acc += input * XXH64_P2;
+
+	return _xxh64_rotl(acc, 31) * XXH64_P1;
+}
+
+static uint64_t _xxh64_merge(uint64_t acc, uint64_t val) {
+	acc ^= _xxh64_round(0, val);
+
+	return acc * XXH64_P1 + XXH64_P4;
+}
+
+static const unsigned char *_xxh64_stripes(unsigned long long *v, const unsigned char *p, const unsigned char *end) {
+	uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+
+	/* Four independent lanes, kept in registers across the whole buffer */
+	for ( ; p + 32 <= end; p += 32) {
+		v1 = _xxh64_round(v1, _checksum_le64(p));
+		v2 = _xxh64_round(v2, _checksum_le64(p + 8));
+		v3 = _xxh64_round(v3, _checksum_le64(p + 16));
+		v4 = _xxh64_round(v4, _checksum_le64(p + 24));
+	}
+
+	v[0] = v1;
+	v[1] = v2;
+	v[2] = v3;
+	v[3] = v4;
+
+	return p;
+}
+
+static void _xxh64_update(struct checksum *ck, const unsigned char *p, size_t len) {
+	const unsigned char *end = p + len;
+	size_t n = 0;
+
+	if (ck->memsize) {
+		n = 32 - ck->memsize < len ? 32 - ck->memsize : len;
+
+		memcpy(ck->mem + ck->memsize, p, n);
+
+		ck->memsize += n;
+		p += n;
+
+		if (ck->memsize < 32)
+			return;
+
+		_xxh64_stripes(ck->v, ck->mem, ck->mem + 32);
+
+		ck->memsize = 0;
+	}
+
+	p = _xxh64_stripes(ck->v, p, end);
+
+	if (p < end) {
+		memcpy(ck->mem, p, end - p);
+		ck->memsize = end - p;
+	}
+}
+
+static uint64_t _xxh64_final(const struct checksum *ck) {
+	uint64_t h = 0;
+	const unsigned char *p = ck->mem, *end = ck->mem + ck->memsize;
+
+	if (ck->total >= 32) {
+		h = _xxh64_rotl(ck->v[0], 1) + _xxh64_rotl(ck->v[1], 7) + _xxh64_rotl(ck->v[2], 12) + _xxh64_rotl(ck->v[3], 18);
+		h = _xxh64_merge(h, ck->v[0]);
+		h = _xxh64_merge(h, ck->v[1]);
+		h = _xxh64_merge(h, ck->v[2]);
+		h = _xxh64_merge(h, ck->v[3]);
+	} else {
+		h = XXH64_P5;
+	}
+
+	h += ck->total;
+
+	for ( ; p + 8 <= end; p += 8) {
+		h ^= _xxh64_round(0, _checksum_le64(p));
+		h = _xxh64_rotl(h, 27) * XXH64_P1 + XXH64_P4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t) _checksum_le32(p) * XXH64_P1;
+		h = _xxh64_rotl(h, 23) * XXH64_P2 + XXH64_P3;
+		p += 4;
+	}
+
+	for ( ; p < end; p ++) {
+		h ^= *p * XXH64_P5;
+		h = _xxh64_rotl(h, 11) * XXH64_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH64_P2;
+	h ^= h >> 29;
+	h *= XXH64_P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+int checksum_init(struct checksum *ck, int algo) {
+	memset(ck, 0, sizeof(struct checksum));
+
+	switch (algo) {
+		case FSOP_CHECKSUM_CRC32C: {
+			ck->crc = 0xffffffff;
+		} break;
+
+		case FSOP_CHECKSUM_XXH64: {
+			ck->v[0] = XXH64_P1 + XXH64_P2;
+			ck->v[1] = XXH64_P2;
+			ck->v[2] = 0;
+			ck->v[3] = -XXH64_P1;
+		} break;
+
+		default: {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	ck->algo = algo;
+
+	return 0;
+}
+
+void checksum_update(struct checksum *ck, const void *buf, size_t len) {
+	ck->total += len;
+
+	if (ck->algo == FSOP_CHECKSUM_XXH64) {
+		_xxh64_update(ck, buf, len);
+		return;
+	}
+
+#ifdef CONFIG_CRC32C_SSE42
+	if (_crc32c_sse42) {
+		ck->crc = _crc32c_hw(ck->crc, buf, len);
+		return;
+	}
+#endif
+
+	ck->crc = _crc32c_sw(ck->crc, buf, len);
+}
+
+unsigned long long checksum_final(const struct checksum *ck) {
+	if (ck->algo == FSOP_CHECKSUM_XXH64)
+		return _xxh64_final(ck);
+
+	return ck->crc ^ 0xffffffff;
+}
+
+static ssize_t _checksum_read(int fd, void *buf, size_t len, off_t off) {
+	if (off < 0)
+		return read(fd, buf, len);
+
+#ifdef COMPILE_WIN32
+	if (lseek(fd, off, SEEK_SET) < 0)
+		return -1;
+
+	return read(fd, buf, len);
+#else
+	return pread(fd, buf, len, off);
+#endif
+}
+
+int checksum_fd(struct checksum *ck, int fd, off_t off, off_t len) {
+	int errsv = 0;
+	ssize_t ret = 0;
+	size_t n = 0;
+	struct mm_buf mb;
+
+	if (mm_buf_get(&mb, CHECKSUM_READ_SIZE) < 0)
+		return -1;
+
+	while (len) {
+		n = len > 0 && len < (off_t) CHECKSUM_READ_SIZE ? (size_t) len : CHECKSUM_READ_SIZE;
+
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = _checksum_read(fd, mb.ptr, n, off)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		if (!ret)
+			break;
+
+		checksum_update(ck, mb.ptr, ret);
+
+		STATS_ADD(FSOP_STAT_BYTES_HASHED, ret);
+
+		if (off >= 0)
+			off += ret;
+
+		if (len > 0)
+			len -= ret;
+	}
+
+	mm_buf_put(&mb);
+
+	return 0;
+
+_error:
+	errsv = errno;
+	mm_buf_put(&mb);
+	errno = errsv;
+	return -1;
+}
+
+#ifndef COMPILE_WIN32
+/* Returns the offset up to which the file was hashed, or -1 on error */
+static off_t _checksum_map(struct checksum *ck, int fd, off_t size) {
+	off_t off = 0;
+	size_t len = 0;
+	void *ptr = NULL;
+
+	for (off = 0; off < size; off += len) {
+		len = size - off < (off_t) CHECKSUM_MAP_SIZE ? (size_t) (size - off) : CHECKSUM_MAP_SIZE;
+
+		/* File systems refusing to map the file are read instead */
+		if ((ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off)) == MAP_FAILED)
+			break;
+
+ #ifdef MADV_SEQUENTIAL
+		madvise(ptr, len, MADV_SEQUENTIAL);
+ #endif
+
+		checksum_update(ck, ptr, len);
+
+		STATS_ADD(FSOP_STAT_BYTES_HASHED, len);
+
+		munmap(ptr, len);
+	}
+
+	return off;
+}
+#endif
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_checksum(const char *file, int algo, unsigned long long *digest) {
+	int fd = 0, errsv = 0;
+	off_t off = -1;
+	struct stat st;
+	struct checksum ck;
+
+	if (checksum_init(&ck, algo) < 0)
+		return -1;
+
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return -1;
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	if (fstat(fd, &st) < 0)
+		goto _error;
+
+#ifndef COMPILE_WIN32
+	if (S_ISREG(st.st_mode))
+		off = _checksum_map(&ck, fd, st.st_size);
+#endif
+
+	/* Whatever wasn't mapped, including data appended meanwhile */
+	if (checksum_fd(&ck, fd, off, -1) < 0)
+		goto _error;
+
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
+
+	close(fd);
+
+	*digest = checksum_final(&ck);
+
+	return 0;
+
+_error:
+	errsv = errno;
+
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
+
+	close(fd);
+
+	errno = errsv;
+
+	return -1;
+}
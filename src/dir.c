@@ -33,13 +33,76 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+ #include <sys/syscall.h>
+#endif
+
 #include "config.h"
 #include "mm.h"
+#include "pool.h"
 #include "path.h"
 #include "dir.h"
 #include "file.h"
+#include "progress.h"
+#include "durable.h"
+#include "cache.h"
+#include "stats.h"
+
+#ifdef CONFIG_POOL
+ #include <pthread.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_getdents64)
+ #define CONFIG_GETDENTS	1
+#endif
+
+/* Directory stream buffer size for each getdents64() batch */
+#define WALK_GETDENTS_SIZE	32768
+
+#ifdef CONFIG_GETDENTS
+struct _walk_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+struct _walk_dir {
+	int fd;
+#ifdef CONFIG_GETDENTS
+	char *buf;
+	size_t len;
+	size_t pos;
+#else
+	DIR *dp;
+ #ifdef COMPILE_WIN32
+	struct dirent *entryp;
+ #endif
+#endif
+};
+
+/* Walk flags */
+#define WALK_PATHS		0x01	/* Build the paths of all entries up front */
+
+/* Directories of a walk are opened relative to this one, unless a descriptor
+ * of their parent is at hand.
+ */
+#ifdef AT_FDCWD
+ #define WALK_CWD		AT_FDCWD
+#else
+ #define WALK_CWD		-1
+#endif
+
+/* Entry cache state */
+#define WALK_STAT_FOLLOW	0x01
+#define WALK_STAT_NOFOLLOW	0x02
+#define WALK_INFO_FOLLOW	0x04
+#define WALK_INFO_NOFOLLOW	0x08
 
 #ifdef COMPILE_WIN32
 /* 
@@ -80,74 +143,185 @@ static int readdir_r(DIR *dirp, struct dirent *entry, struct dirent **result) {
 }
 #endif
 
-#ifdef COMPILE_WIN32
-DLLIMPORT
+/* Descriptors held on each directory while creating its subdirectories */
+#ifdef O_PATH
+ #define PMKDIR_OPEN_FLAGS	(O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+ #define PMKDIR_OPEN_FLAGS	(O_RDONLY | O_DIRECTORY | O_CLOEXEC)
 #endif
-int fsop_pmkdir(const char *path, mode_t mode) {
-	char *lpath = NULL, *cpath = NULL, *ptr = NULL, *saveptr = NULL;
-	size_t len = 0;
+
+/* Durable tree operations pass their options, so the parent of each directory
+ * created is synced when the operation ends.
+ */
+static int _pmkdir(const char *path, mode_t mode, const struct fsop_opts *opts) {
+	char *buf = NULL, *end = NULL, *ptr = NULL, *sep = NULL, *comp = NULL;
+	size_t len = strlen(path);
 	int errsv = 0;
+#ifndef COMPILE_WIN32
+	int fd = AT_FDCWD, nfd = -1;
+#endif
+	unsigned long long t = 0;
+	struct mm_arena *arena = NULL;
+	struct mm_arena_mark mark;
+
+	STATS_TIME_START(t);
+
+	/* Usually all the parents already exist, so the whole path is tried first */
+	STATS_INC(FSOP_STAT_SYS_MKDIR);
+
+	if (!mkdir(path, mode)) {
+		CACHE_INVALIDATE(path);
+		STATS_TIME_STOP(t, FSOP_STAT_TIME_MKDIR);
+		return opts ? durable_entry(opts, path) : 0;
+	}
+
+	if (errno != ENOENT) {
+		errsv = errno;
+		STATS_TIME_STOP(t, FSOP_STAT_TIME_MKDIR);
+
+		/* Existing directories, possibly created by a concurrent call */
+		if (errsv == EEXIST)
+			return 0;
 
-	if (!(lpath = mm_alloc(strlen(path) + 1)))
+		errno = errsv;
+		return -1;
+	}
+
+	if (!(arena = mm_arena_thread()))
 		return -1;
 
-	strcpy(lpath, path);
+	mm_arena_mark(arena, &mark);
 
-	if (!(ptr = strtok_r(lpath, "/", &saveptr))) {
-		int ret = 0;
+	if (!(buf = mm_arena_alloc(arena, len + 1)))
+		goto _error;
 
-		if (!fsop_path_exists(lpath)) {
-			ret = mkdir(lpath, mode);
-			errsv = errno;
+	memcpy(buf, path, len + 1);
+
+	/* Trailing separators don't name any component */
+	for (end = buf + len; end > buf + 1 && end[-1] == '/'; )
+		*-- end = 0;
+
+	/* Walk backwards, cutting the last component of the prefix on each step,
+	 * until an ancestor is created or found to exist. Each cut is left as a
+	 * terminator of the component before it.
+	 */
+	for (ptr = end; ; ptr = sep) {
+		while (ptr > buf && ptr[-1] != '/')
+			ptr --;
+
+		/* Relative path with no existing ancestor: start from the working
+		 * directory.
+		 */
+		if (ptr == buf) {
+			comp = buf;
+			break;
 		}
 
-		mm_free(lpath);
-		errno = errsv;
+		for (sep = ptr - 1; sep > buf && sep[-1] == '/'; )
+			sep --;
 
-		return ret;
-	}
+		/* Only the root remains */
+		if (sep == buf) {
+#ifndef COMPILE_WIN32
+			STATS_INC(FSOP_STAT_SYS_OPEN);
 
-	len = strlen(ptr) + 1 + (path[0] == '/');
+			if ((fd = open("/", PMKDIR_OPEN_FLAGS)) < 0)
+				goto _error;
+#endif
+			comp = ptr;
+			break;
+		}
 
-	if (!(cpath = mm_alloc(len))) {
-		errsv = errno;
-		mm_free(lpath);
-		errno = errsv;
-		return -1;
-	}
+		*sep = 0;
+
+		STATS_INC(FSOP_STAT_SYS_MKDIR);
+
+		if (!mkdir(buf, mode)) {
+			CACHE_INVALIDATE(buf);
 
-	memset(cpath, 0, len);
-	cpath[0] = path[0] == '/' ? '/' : 0;
-	strcat(cpath, ptr);
+			if (opts && durable_entry(opts, buf) < 0)
+				goto _error;
+		} else if (errno != EEXIST) {
+			if (errno == ENOENT)
+				continue;
 
-	if (!fsop_path_exists(cpath)) {
-		if (mkdir(cpath, mode) < 0)
 			goto _error;
-	}
+		}
 
-	while ((ptr = strtok_r(NULL, "/", &saveptr))) {
-		len += strlen(ptr) + 2;
+#ifndef COMPILE_WIN32
+		STATS_INC(FSOP_STAT_SYS_OPEN);
 
-		if (!(cpath = mm_realloc(cpath, len)))
+		if ((fd = open(buf, PMKDIR_OPEN_FLAGS)) < 0)
 			goto _error;
+#endif
+		for (*sep = '/', comp = sep; *comp == '/'; )
+			comp ++;
 
-		strcat(cpath, "/");
-		strcat(cpath, ptr);
+		break;
+	}
+
+	/* Create the missing components forward, relative to their parent */
+	for ( ; ; comp = ptr) {
+		ptr = comp + strlen(comp);
+
+		STATS_INC(FSOP_STAT_SYS_MKDIR);
+
+#ifdef COMPILE_WIN32
+		if (mkdir(buf, mode) < 0) {
+#else
+		if (mkdirat(fd, comp, mode) < 0) {
+#endif
+			if (errno != EEXIST)
+				goto _error;
+		} else {
+			CACHE_INVALIDATE(buf);
 
-		if (!fsop_path_exists(cpath)) {
-			if (mkdir(cpath, mode) < 0)
+			if (opts && durable_entry(opts, buf) < 0)
 				goto _error;
 		}
+
+		if (ptr == end)
+			break;
+
+#ifndef COMPILE_WIN32
+		STATS_INC(FSOP_STAT_SYS_OPEN);
+
+		if ((nfd = openat(fd, comp, PMKDIR_OPEN_FLAGS)) < 0)
+			goto _error;
+
+		if (fd != AT_FDCWD) {
+			STATS_INC(FSOP_STAT_SYS_CLOSE);
+			close(fd);
+		}
+
+		fd = nfd;
+#endif
+		for (*ptr = '/'; *ptr == '/'; )
+			ptr ++;
+	}
+
+#ifndef COMPILE_WIN32
+	if (fd != AT_FDCWD) {
+		STATS_INC(FSOP_STAT_SYS_CLOSE);
+		close(fd);
 	}
+#endif
 
-	mm_free(lpath);
-	mm_free(cpath);
+	mm_arena_release(arena, &mark);
+	STATS_TIME_STOP(t, FSOP_STAT_TIME_MKDIR);
 
 	return 0;
+
 _error:
 	errsv = errno;
-	mm_free(cpath);
-	mm_free(lpath);
+#ifndef COMPILE_WIN32
+	if (fd != AT_FDCWD) {
+		STATS_INC(FSOP_STAT_SYS_CLOSE);
+		close(fd);
+	}
+#endif
+	mm_arena_release(arena, &mark);
+	STATS_TIME_STOP(t, FSOP_STAT_TIME_MKDIR);
 	errno = errsv;
 	return -1;
 }
@@ -155,176 +329,1056 @@ _error:
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-int fsop_walkdir(
-		const char *dir,
-		const char *prefix,
-		int (*action)
-			(int order,
-			const char *fpath,
-			const char *rpath,
-			void *arg),
-		void *arg)
-{
-	DIR *sdp = NULL;
-	struct dirent *entryp = NULL, *result = NULL;
-	char *fpath = NULL, *rpath = NULL;
-	int errsv = 0;
+int fsop_pmkdir(const char *path, mode_t mode) {
+	return _pmkdir(path, mode, NULL);
+}
+
+/* Opens the directory 'name', relative to 'dirfd'. Windows has no descriptor
+ * relative calls, so its full path 'dir' is used there instead.
+ */
+static int _walk_open(struct _walk_dir *wd, int dirfd, const char *name, const char *dir, struct mm_arena *arena) {
+	memset(wd, 0, sizeof(struct _walk_dir));
 
-	if (!fsop_path_isdir(dir))
+	STATS_INC(FSOP_STAT_WALK_DIRS);
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+#ifdef CONFIG_GETDENTS
+	(void) dir;
+
+	if (!(wd->buf = mm_arena_alloc(arena, WALK_GETDENTS_SIZE)))
 		return -1;
 
-	if (!(sdp = opendir(dir)))
+	if ((wd->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
 		return -1;
+#elif defined(COMPILE_WIN32)
+	(void) dirfd;
+	(void) name;
+	(void) arena;
 
-#ifdef COMPILE_WIN32
-	if (!(entryp = mm_alloc(offsetof(struct dirent, d_name) + CONFIG_PATH_MAX + 1)))
-#else
-	if (!(entryp = mm_alloc(offsetof(struct dirent, d_name) + pathconf(dir, _PC_NAME_MAX) + 1)))
-#endif
+	if (!fsop_path_isdir(dir)) {
+		errno = ENOTDIR;
 		return -1;
+	}
 
-	if (action(FSOP_WALK_PREORDER, dir, prefix, arg) < 0)
-		goto _error3;
+	if (!(wd->dp = opendir(dir)))
+		return -1;
 
-	while (!(errsv = readdir_r(sdp, entryp, &result))) {
-		if (!result)
-			break;
+	if (!(wd->entryp = mm_alloc(offsetof(struct dirent, d_name) + CONFIG_PATH_MAX + 1))) {
+		closedir(wd->dp);
+		return -1;
+	}
 
-		if (!strcmp(result->d_name, ".") || !strcmp(result->d_name, ".."))
-			continue;
+	wd->fd = -1;
+#else
+	(void) dir;
+	(void) arena;
 
-		if (!(fpath = mm_alloc(strlen(dir) + strlen(result->d_name) + 2))) {
-			errsv = errno;
-			goto _error3;
-		}
+	if ((wd->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
 
-		if (!(rpath = mm_alloc((prefix ? strlen(prefix) : 0) + strlen(result->d_name) + 2))) {
-			errsv = errno;
-			goto _error2;
-		}
+	if (!(wd->dp = fdopendir(wd->fd))) {
+		close(wd->fd);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
 
-		sprintf(fpath, "%s/%s", dir, result->d_name);
+static void _walk_close(struct _walk_dir *wd) {
+	int errsv = errno;
 
-		if (prefix)
-			sprintf(rpath, "%s/%s", prefix, result->d_name);
-		else
-			sprintf(rpath, "%s", result->d_name);
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
 
-		if (action(FSOP_WALK_INORDER, fpath, rpath, arg) < 0)
-			goto _error;
+#ifdef CONFIG_GETDENTS
+	close(wd->fd);
+#elif defined(COMPILE_WIN32)
+	mm_free(wd->entryp);
+	closedir(wd->dp);
+#else
+	closedir(wd->dp);
+#endif
 
-		mm_free(fpath);
-		mm_free(rpath);
+	errno = errsv;
+}
+
+#ifdef DT_UNKNOWN
+static int _walk_dtype(unsigned char d_type) {
+	switch (d_type) {
+		case DT_FIFO: return FSOP_WALK_TYPE_FIFO;
+		case DT_CHR: return FSOP_WALK_TYPE_CHR;
+		case DT_DIR: return FSOP_WALK_TYPE_DIR;
+		case DT_BLK: return FSOP_WALK_TYPE_BLK;
+		case DT_REG: return FSOP_WALK_TYPE_REG;
+		case DT_LNK: return FSOP_WALK_TYPE_LNK;
+		case DT_SOCK: return FSOP_WALK_TYPE_SOCK;
 	}
 
-	if (action(FSOP_WALK_POSTORDER, dir, prefix, arg) < 0)
-		goto _error3;
+	return FSOP_WALK_TYPE_UNKNOWN;
+}
+#endif
 
-	mm_free(entryp);
-	closedir(sdp);
+static int _walk_mtype(mode_t mode) {
+	if (S_ISDIR(mode))
+		return FSOP_WALK_TYPE_DIR;
+	else if (S_ISREG(mode))
+		return FSOP_WALK_TYPE_REG;
+#ifndef COMPILE_WIN32
+	else if (S_ISLNK(mode))
+		return FSOP_WALK_TYPE_LNK;
+	else if (S_ISFIFO(mode))
+		return FSOP_WALK_TYPE_FIFO;
+	else if (S_ISCHR(mode))
+		return FSOP_WALK_TYPE_CHR;
+	else if (S_ISBLK(mode))
+		return FSOP_WALK_TYPE_BLK;
+	else if (S_ISSOCK(mode))
+		return FSOP_WALK_TYPE_SOCK;
+#endif
 
-	return -!!(errno = errsv);
-_error:
-	errsv = errno;
-	mm_free(rpath);
-_error2:
-	mm_free(fpath);
-_error3:
-	mm_free(entryp);
-	closedir(sdp);
-	errno = errsv;
-	return -1;
+	return FSOP_WALK_TYPE_UNKNOWN;
 }
 
-static int _cpdir_action(
-		int order,
-		const char *fpath,
-		const char *rpath,
-		void *arg)
-{
-	struct stat st;
+/* Returns 1 when an entry was read, 0 at the end of the directory and -1 on
+ * error. The entry name remains valid until the next call.
+ */
+static int _walk_next(struct _walk_dir *wd, struct fsop_walk_entry *e) {
+#ifdef CONFIG_GETDENTS
+	long ret = 0;
+	unsigned long long t = 0;
+	struct _walk_dirent64 *d = NULL;
 
-	if (order == FSOP_WALK_PREORDER) {
-		if (stat(fpath, &st) < 0)
-			return -1;
+	if (wd->pos >= wd->len) {
+		STATS_INC(FSOP_STAT_SYS_GETDENTS);
+		STATS_TIME_START(t);
 
-		return fsop_pmkdir(rpath, st.st_mode);
-	} else if (order == FSOP_WALK_INORDER) {
-		if (stat(fpath, &st) < 0)
+		ret = syscall(SYS_getdents64, wd->fd, wd->buf, WALK_GETDENTS_SIZE);
+
+		STATS_TIME_STOP(t, FSOP_STAT_TIME_SCAN);
+
+		if (ret < 0)
 			return -1;
 
-		if (S_ISDIR(st.st_mode)) {
-			if (fsop_cpdir(fpath, rpath, *(size_t *) arg) < 0)
-				return -1;
-		} else {
-			return fsop_cp(fpath, rpath, *(size_t *) arg);
-		}
+		if (!ret)
+			return 0;
+
+		wd->len = ret;
+		wd->pos = 0;
 	}
 
-	return 0;
+	d = (struct _walk_dirent64 *) (wd->buf + wd->pos);
+	wd->pos += d->d_reclen;
+
+	e->name = d->d_name;
+	e->type = _walk_dtype(d->d_type);
+	e->ino = d->d_ino;
+#else
+	struct dirent *result = NULL;
+
+ #ifdef COMPILE_WIN32
+	if (readdir_r(wd->dp, wd->entryp, &result))
+		return -1;
+ #else
+	errno = 0;
+
+	if (!(result = readdir(wd->dp)) && errno)
+		return -1;
+ #endif
+
+	if (!result)
+		return 0;
+
+	e->name = result->d_name;
+ #ifdef DT_UNKNOWN
+	e->type = _walk_dtype(result->d_type);
+ #else
+	e->type = FSOP_WALK_TYPE_UNKNOWN;
+ #endif
+	e->ino = result->d_ino;
+#endif
+
+	return 1;
 }
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-int fsop_cpdir(const char *src, const char *dest, size_t block) {
-	return fsop_walkdir(src, dest, &_cpdir_action, &block);
-}		
+const struct stat *fsop_walk_entry_stat(struct fsop_walk_entry *entry, int follow) {
+	int cached = follow ? WALK_STAT_FOLLOW : WALK_STAT_NOFOLLOW;
 
-static int _rmdir_action(
-		int order,
-		const char *fpath,
-		const char *rpath,
-		void *arg)
-{
-	struct stat st;
+	if (entry->_cached & cached)
+		return &entry->_st;
 
-	if (order == FSOP_WALK_POSTORDER) {
-		if (stat(fpath, &st) < 0)
-			return -1;
+	STATS_INC(FSOP_STAT_SYS_STAT);
 
-		return rmdir(fpath);
-	} else if (order == FSOP_WALK_INORDER) {
-		if (stat(fpath, &st) < 0)
-			return -1;
+#ifdef COMPILE_WIN32
+	if (stat(entry->fpath, &entry->_st) < 0)
+		return NULL;
+#else
+	if (fstatat(entry->dirfd, entry->name, &entry->_st, follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+		return NULL;
+#endif
 
-		if (S_ISDIR(st.st_mode)) {
-			if (fsop_rmdir(fpath) < 0)
-				return -1;
-		} else {
-			return unlink(fpath);
-		}
+	entry->_cached = (entry->_cached & ~(WALK_STAT_FOLLOW | WALK_STAT_NOFOLLOW)) | cached;
+
+	/* The entry type always describes the entry itself, never a link target */
+	if (!follow)
+		entry->type = _walk_mtype(entry->_st.st_mode);
+
+	/*
+	 * Anything but a symbolic link gives the same result both ways. A followed
+	 * result only says so when the entry itself is already known not to be one.
+	 */
+	if (entry->type != FSOP_WALK_TYPE_UNKNOWN && entry->type != FSOP_WALK_TYPE_LNK)
+		entry->_cached |= WALK_STAT_FOLLOW | WALK_STAT_NOFOLLOW;
+
+	return &entry->_st;
+}
+
+#ifndef COMPILE_WIN32
+const struct fsop_path_info *fsop_walk_entry_info(struct fsop_walk_entry *entry, unsigned int mask, int flags) {
+	int cached = (flags & FSOP_PATH_NOFOLLOW) ? WALK_INFO_NOFOLLOW : WALK_INFO_FOLLOW;
+
+	mask &= FSOP_PATH_INFO_ALL;
+
+	if (entry->_cached & cached) {
+		if (!(mask & ~entry->_info.mask))
+			return &entry->_info;
+
+		/* Keep the fields already fetched */
+		mask |= entry->_info.mask;
 	}
 
-	return 0;
+	/* The type is always requested, to know whether this is a link */
+	if (fsop_path_info_at(entry->dirfd, entry->name, mask | FSOP_PATH_INFO_TYPE, flags, &entry->_info) < 0)
+		return NULL;
+
+	entry->_cached = (entry->_cached & ~(WALK_INFO_FOLLOW | WALK_INFO_NOFOLLOW)) | cached;
+
+	if (flags & FSOP_PATH_NOFOLLOW)
+		entry->type = _walk_mtype(entry->_info.mode);
+
+	if (entry->type != FSOP_WALK_TYPE_UNKNOWN && entry->type != FSOP_WALK_TYPE_LNK)
+		entry->_cached |= WALK_INFO_FOLLOW | WALK_INFO_NOFOLLOW;
+
+	return &entry->_info;
 }
+#endif
 
+static int _walk_entry_type(struct fsop_walk_entry *entry, int follow, int flags) {
 #ifdef COMPILE_WIN32
-DLLIMPORT
+	const struct stat *st = NULL;
+#else
+	const struct fsop_path_info *info = NULL;
 #endif
-int fsop_rmdir(const char *dir) {
-	return fsop_walkdir(dir, NULL, &_rmdir_action, NULL);
-}		
+
+	if (entry->type != FSOP_WALK_TYPE_UNKNOWN && (!follow || entry->type != FSOP_WALK_TYPE_LNK))
+		return entry->type;
+
+#ifdef COMPILE_WIN32
+	if (!(st = fsop_walk_entry_stat(entry, follow)))
+		return -1;
+
+	return _walk_mtype(st->st_mode);
+#else
+	/* Only the file type has to be fetched */
+	if (!(info = fsop_walk_entry_info(entry, FSOP_PATH_INFO_TYPE, flags | (follow ? 0 : FSOP_PATH_NOFOLLOW))))
+		return -1;
+
+	return _walk_mtype(info->mode);
+#endif
+}
+
+static int _walk_entry_mode(struct fsop_walk_entry *entry, int flags, mode_t *mode) {
+#ifdef COMPILE_WIN32
+	const struct stat *st = NULL;
+
+	if (!(st = fsop_walk_entry_stat(entry, 1)))
+		return -1;
+
+	*mode = st->st_mode;
+#else
+	const struct fsop_path_info *info = NULL;
+
+	if (!(info = fsop_walk_entry_info(entry, FSOP_PATH_INFO_TYPE | FSOP_PATH_INFO_MODE, flags)))
+		return -1;
+
+	*mode = info->mode;
+#endif
+
+	return 0;
+}
+
+static int _walk_flags(const struct fsop_opts *opts) {
+	return (opts && (opts->flags & FSOP_OPT_DONT_SYNC)) ? FSOP_PATH_DONT_SYNC : 0;
+}
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-int fsop_mvdir(const char *src, const char *dest, size_t block) {
-	if (!rename(src, dest))
+int fsop_walk_entry_type(struct fsop_walk_entry *entry, int follow) {
+	return _walk_entry_type(entry, follow, 0);
+}
+
+/* Builds the full and relative paths of an entry, if not built yet. Walks
+ * started without the path of their directory leave them unset.
+ */
+static int _walk_entry_paths(struct fsop_walk_entry *e) {
+	char *fpath = NULL, *rpath = NULL;
+	size_t dlen = 0, plen = 0, nlen = 0;
+	struct mm_arena *arena = NULL;
+
+	if (e->fpath || !e->_dir)
 		return 0;
 
-	if (fsop_path_exists(dest)) {
-		/* Must be an empty directory */
-		if (rmdir(dest) < 0)
-			return -1;
-	}
+	dlen = strlen(e->_dir);
+	plen = e->_prefix ? strlen(e->_prefix) : 0;
+	nlen = strlen(e->name);
+
+	/* Released along with the other transient buffers of the entry */
+	if (!(arena = mm_arena_thread()))
+		return -1;
 
-	if (fsop_cpdir(src, dest, block) < 0)
+	if (!(fpath = mm_arena_alloc(arena, dlen + nlen + 2)))
 		return -1;
 
-	if (fsop_rmdir(src) < 0)
+	if (!(rpath = mm_arena_alloc(arena, plen + nlen + 2)))
 		return -1;
 
+	memcpy(fpath, e->_dir, dlen);
+	fpath[dlen] = '/';
+	memcpy(fpath + dlen + 1, e->name, nlen + 1);
+
+	if (e->_prefix) {
+		memcpy(rpath, e->_prefix, plen);
+		rpath[plen] = '/';
+		memcpy(rpath + plen + 1, e->name, nlen + 1);
+	} else {
+		memcpy(rpath, e->name, nlen + 1);
+	}
+
+	e->fpath = fpath;
+	e->rpath = rpath;
+
 	return 0;
 }
 
+/*
+ * Walks the directory 'name', opened relative to 'dirfd'. 'dir' is its path,
+ * used to build the paths of the entries, and may be NULL when the actions
+ * don't need them. Unless WALK_PATHS is set, paths are only built when asked
+ * for through _walk_entry_paths().
+ */
+static int _fsop_walk(
+		int dirfd,
+		const char *name,
+		const char *dir,
+		const char *prefix,
+		int flags,
+		const struct fsop_opts *opts,
+		int (*action)
+			(int order,
+			struct fsop_walk_entry *e,
+			void *arg),
+		void *arg)
+{
+	struct _walk_dir wd;
+	struct fsop_walk_entry e;
+	struct mm_arena *arena = NULL;
+	struct mm_arena_mark mdir, mentry;
+	int errsv = 0, ret = 0;
+
+#ifdef COMPILE_WIN32
+	/* Entries are only reachable through their full path */
+	flags |= WALK_PATHS;
+#endif
+
+	/* Transient buffers of this directory are taken from the thread arena and
+	 * released all at once when the walk of this directory ends.
+	 */
+	if (!(arena = mm_arena_thread()))
+		return -1;
+
+	mm_arena_mark(arena, &mdir);
+
+	if (_walk_open(&wd, dirfd, name, dir, arena) < 0)
+		goto _error2;
+
+	mm_arena_mark(arena, &mentry);
+
+	/* The directory itself is described by its own descriptor */
+	memset(&e, 0, sizeof(struct fsop_walk_entry));
+
+	e.dirfd = wd.fd;
+	e.name = ".";
+	e.fpath = dir;
+	e.rpath = prefix;
+	e.type = FSOP_WALK_TYPE_DIR;
+
+	if (action(FSOP_WALK_PREORDER, &e, arg) < 0)
+		goto _error;
+
+	while ((ret = _walk_next(&wd, &e)) > 0) {
+		if (e.name[0] == '.' && (!e.name[1] || (e.name[1] == '.' && !e.name[2])))
+			continue;
+
+		e.dirfd = wd.fd;
+		e.fpath = NULL;
+		e.rpath = NULL;
+		e._dir = dir;
+		e._prefix = prefix;
+		e._cached = 0;
+
+		if ((flags & WALK_PATHS) && _walk_entry_paths(&e) < 0)
+			goto _error;
+
+		STATS_INC(FSOP_STAT_WALK_ENTRIES);
+
+		if (opts && opts->_progress && (_walk_entry_paths(&e) < 0 || progress_entry(opts, e.fpath) < 0))
+			goto _error;
+
+		if (action(FSOP_WALK_INORDER, &e, arg) < 0)
+			goto _error;
+
+		mm_arena_release(arena, &mentry);
+	}
+
+	if (ret < 0)
+		goto _error;
+
+	e.dirfd = wd.fd;
+	e.name = ".";
+	e.fpath = dir;
+	e.rpath = prefix;
+	e.type = FSOP_WALK_TYPE_DIR;
+	e.ino = 0;
+	e._dir = NULL;
+	e._prefix = NULL;
+	e._cached = 0;
+
+	if (action(FSOP_WALK_POSTORDER, &e, arg) < 0)
+		goto _error;
+
+	_walk_close(&wd);
+	mm_arena_release(arena, &mdir);
+
+	return 0;
+
+_error:
+	_walk_close(&wd);
+_error2:
+	errsv = errno;
+	mm_arena_release(arena, &mdir);
+	errno = errsv;
+	return -1;
+}
+
+struct _walkdir_user {
+	int (*action) (int order, const char *fpath, const char *rpath, void *arg);
+	void *arg;
+};
+
+static int _walkdir_action(int order, struct fsop_walk_entry *e, void *arg) {
+	struct _walkdir_user *user = arg;
+
+	return user->action(order, e->fpath, e->rpath, user->arg);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_walkdir(
+		const char *dir,
+		const char *prefix,
+		int (*action)
+			(int order,
+			const char *fpath,
+			const char *rpath,
+			void *arg),
+		void *arg)
+{
+	struct _walkdir_user user;
+
+	user.action = action;
+	user.arg = arg;
+
+	return _fsop_walk(WALK_CWD, dir, dir, prefix, WALK_PATHS, NULL, &_walkdir_action, &user);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_walkdir_ext(
+		const char *dir,
+		const char *prefix,
+		int (*action)
+			(int order,
+			struct fsop_walk_entry *entry,
+			void *arg),
+		void *arg)
+{
+	return _fsop_walk(WALK_CWD, dir, dir, prefix, WALK_PATHS, NULL, action, arg);
+}
+
+static int _rmdir_tree(int dirfd, const char *name, const char *dir, const struct fsop_opts *opts);
+
+#ifndef COMPILE_WIN32
+struct _prune {
+	int sfd;			/* Source directory */
+	const struct fsop_opts *opts;
+};
+
+static int _prune_action(int order, struct fsop_walk_entry *e, void *arg) {
+	int type = 0;
+	struct _prune *pr = arg;
+	struct fsop_path_info info;
+
+	if (order != FSOP_WALK_INORDER)
+		return 0;
+
+	if (!fsop_path_info_at(pr->sfd, e->name, 0, FSOP_PATH_NOFOLLOW | _walk_flags(pr->opts), &info))
+		return 0;
+
+	if (errno != ENOENT)
+		return -1;
+
+	/* Symbolic links are removed, never followed */
+	if ((type = _walk_entry_type(e, 0, _walk_flags(pr->opts))) < 0)
+		return -1;
+
+	if (type == FSOP_WALK_TYPE_DIR) {
+		if (_rmdir_tree(e->dirfd, e->name, NULL, NULL) < 0)
+			return -1;
+	} else {
+		STATS_INC(FSOP_STAT_SYS_UNLINK);
+
+		if (unlinkat(e->dirfd, e->name, 0) < 0)
+			return -1;
+	}
+
+	/* The path is only needed to invalidate cached metadata */
+	if (cache_enabled && !_walk_entry_paths(e))
+		cache_invalidate(e->fpath, type == FSOP_WALK_TYPE_DIR);
+
+	return 0;
+}
+
+/* Removes the entries of 'dest' missing from the source directory at 'sfd' */
+static int _cpdir_prune(int sfd, const char *dest, const struct fsop_opts *opts) {
+	struct _prune pr;
+
+	pr.sfd = sfd;
+	pr.opts = opts;
+
+	return _fsop_walk(WALK_CWD, dest, dest, NULL, 0, NULL, &_prune_action, &pr);
+}
+#endif
+
+static int _cpdir_action(int order, struct fsop_walk_entry *e, void *arg) {
+	int type = 0;
+	mode_t mode = 0;
+	const struct fsop_opts *opts = arg;
+
+	if (order == FSOP_WALK_PREORDER) {
+		if (_walk_entry_mode(e, _walk_flags(opts), &mode) < 0)
+			return -1;
+
+		if (_pmkdir(e->rpath, mode, opts) < 0)
+			return -1;
+
+		/* Also records the parent of the top-level destination */
+		return durable_entry(opts, e->rpath);
+	} else if (order == FSOP_WALK_INORDER) {
+		/* Symbolic links are copied as the element they point to */
+		if ((type = _walk_entry_type(e, 1, _walk_flags(opts))) < 0)
+			return -1;
+
+		if (_walk_entry_paths(e) < 0)
+			return -1;
+
+		/* Subdirectories are opened relative to their parent */
+		if (type == FSOP_WALK_TYPE_DIR)
+			return _fsop_walk(e->dirfd, e->name, e->fpath, e->rpath, 0, opts, &_cpdir_action, arg);
+
+		return fsop_cp_ext(e->fpath, e->rpath, opts);
+#ifndef COMPILE_WIN32
+	} else if (order == FSOP_WALK_POSTORDER && (opts->flags & FSOP_OPT_SYNC_DELETE)) {
+		return _cpdir_prune(e->dirfd, e->rpath, opts);
+#endif
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_POOL
+struct _pcpdir {
+	const struct fsop_opts *opts;
+	struct pool *pool;
+	pthread_mutex_t lock;
+	int errors;
+	int errsv;
+};
+
+struct _pcpdir_job {
+	struct _pcpdir *ctx;
+	struct _pcpdir_job *parent;	/* Directory job that submitted this file */
+	int refs;			/* Directories: scan plus files in progress */
+	char *src;
+	char *dest;
+};
+
+static void _pcpdir_error(struct _pcpdir *ctx, int errsv) {
+	pthread_mutex_lock(&ctx->lock);
+
+	if (!ctx->errors ++)
+		ctx->errsv = errsv;
+
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/* The last reference to a directory job is dropped once its scan ended and all
+ * the files it submitted were copied, so the destination can then be pruned
+ * without removing the temporary files of copies still in progress.
+ */
+static void _pcpdir_put(struct _pcpdir_job *job) {
+	int sfd = -1;
+
+	if (__sync_sub_and_fetch(&job->refs, 1))
+		return;
+
+	if (job->ctx->opts->flags & FSOP_OPT_SYNC_DELETE) {
+		STATS_INC(FSOP_STAT_SYS_OPEN);
+
+		if ((sfd = open(job->src, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 || _cpdir_prune(sfd, job->dest, job->ctx->opts) < 0)
+			_pcpdir_error(job->ctx, errno);
+
+		if (sfd >= 0) {
+			STATS_INC(FSOP_STAT_SYS_CLOSE);
+			close(sfd);
+		}
+	}
+
+	mm_free(job);
+}
+
+static void _pcpdir_file(void *arg) {
+	struct _pcpdir_job *job = arg;
+
+	if (fsop_cp_ext(job->src, job->dest, job->ctx->opts) < 0)
+		_pcpdir_error(job->ctx, errno);
+
+	_pcpdir_put(job->parent);
+
+	mm_free(job);
+}
+
+static void _pcpdir_dir(void *arg);
+
+static int _pcpdir_submit(struct _pcpdir *ctx, struct _pcpdir_job *parent, const char *src, const char *dest, int dir) {
+	struct _pcpdir_job *job = NULL;
+	size_t slen = strlen(src) + 1, dlen = strlen(dest) + 1;
+
+	if (!(job = mm_alloc(sizeof(struct _pcpdir_job) + slen + dlen)))
+		return -1;
+
+	job->ctx = ctx;
+	job->parent = dir ? NULL : parent;
+	job->refs = 1;
+	job->src = (char *) (job + 1);
+	job->dest = job->src + slen;
+
+	memcpy(job->src, src, slen);
+	memcpy(job->dest, dest, dlen);
+
+	if (job->parent)
+		__sync_add_and_fetch(&job->parent->refs, 1);
+
+	if (pool_submit(ctx->pool, dir ? &_pcpdir_dir : &_pcpdir_file, job) < 0) {
+		if (job->parent)
+			__sync_sub_and_fetch(&job->parent->refs, 1);
+
+		mm_free(job);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _pcpdir_action(int order, struct fsop_walk_entry *e, void *arg) {
+	int type = 0;
+	mode_t mode = 0;
+	struct _pcpdir_job *job = arg;
+	struct _pcpdir *ctx = job->ctx;
+
+	/* The destination directory is created before any of its entries is
+	 * submitted, so no job ever writes into a missing parent.
+	 */
+	if (order == FSOP_WALK_PREORDER) {
+		if (_walk_entry_mode(e, _walk_flags(ctx->opts), &mode) < 0)
+			return -1;
+
+		if (_pmkdir(e->rpath, mode, ctx->opts) < 0)
+			return -1;
+
+		/* Also records the parent of the top-level destination */
+		return durable_entry(ctx->opts, e->rpath);
+	} else if (order == FSOP_WALK_INORDER) {
+		if ((type = _walk_entry_type(e, 1, _walk_flags(ctx->opts))) < 0)
+			return -1;
+
+		if (_walk_entry_paths(e) < 0)
+			return -1;
+
+		return _pcpdir_submit(ctx, job, e->fpath, e->rpath, type == FSOP_WALK_TYPE_DIR);
+	}
+
+	return 0;
+}
+
+static void _pcpdir_dir(void *arg) {
+	struct _pcpdir_job *job = arg;
+
+	if (_fsop_walk(WALK_CWD, job->src, job->src, job->dest, 0, job->ctx->opts, &_pcpdir_action, job) < 0)
+		_pcpdir_error(job->ctx, errno);
+
+	/* Pruning is left to whoever drops the last reference */
+	_pcpdir_put(job);
+}
+
+static int _pcpdir(const char *src, const char *dest, const struct fsop_opts *opts) {
+	struct _pcpdir ctx;
+
+	memset(&ctx, 0, sizeof(struct _pcpdir));
+
+	ctx.opts = opts;
+
+	if (!(ctx.pool = pool_create(opts->threads)))
+		return -1;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	if (_pcpdir_submit(&ctx, NULL, src, dest, 1) < 0)
+		_pcpdir_error(&ctx, errno);
+
+	pool_wait(ctx.pool);
+	pool_destroy(ctx.pool);
+
+	pthread_mutex_destroy(&ctx.lock);
+
+	if (ctx.errors) {
+		errno = ctx.errsv;
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+static int _fsop_cpdir(const char *src, const char *dest, const struct fsop_opts *opts) {
+#ifdef CONFIG_POOL
+	if (opts->threads > 1)
+		return _pcpdir(src, dest, opts);
+#endif
+
+	return _fsop_walk(WALK_CWD, src, src, dest, 0, opts, &_cpdir_action, (void *) opts);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_cpdir_ext(const char *src, const char *dest, const struct fsop_opts *opts) {
+	struct progress pg;
+	struct durable dg;
+	struct fsop_opts popts, dopts;
+
+	opts = progress_begin(&pg, &popts, opts);
+	opts = durable_begin(&dg, &dopts, opts);
+
+	return progress_end(&pg, opts, durable_end(&dg, opts, _fsop_cpdir(src, dest, opts)));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_cpdir(const char *src, const char *dest, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_cpdir_ext(src, dest, &opts);
+}
+
+static int _rmdir_action(int order, struct fsop_walk_entry *e, void *arg) {
+	int type = 0;
+
+	if (order != FSOP_WALK_INORDER)
+		return 0;
+
+	/* Symbolic links are removed, never followed */
+	if ((type = _walk_entry_type(e, 0, _walk_flags(arg))) < 0)
+		return -1;
+
+	/* Subdirectories are opened and removed relative to their parent */
+	if (type == FSOP_WALK_TYPE_DIR)
+		return _rmdir_tree(e->dirfd, e->name, e->fpath, arg);
+
+	STATS_INC(FSOP_STAT_SYS_UNLINK);
+
+#ifdef COMPILE_WIN32
+	return unlink(e->fpath);
+#else
+	return unlinkat(e->dirfd, e->name, 0);
+#endif
+}
+
+/* Removes the directory 'name', relative to 'dirfd', and all its contents.
+ * Its path 'dir' is only required on Windows, or for progress reports.
+ */
+static int _rmdir_tree(int dirfd, const char *name, const char *dir, const struct fsop_opts *opts) {
+	if (_fsop_walk(dirfd, name, dir, NULL, 0, opts, &_rmdir_action, (void *) opts) < 0)
+		return -1;
+
+	STATS_INC(FSOP_STAT_SYS_RMDIR);
+
+#ifdef COMPILE_WIN32
+	return rmdir(dir);
+#else
+	return unlinkat(dirfd, name, AT_REMOVEDIR);
+#endif
+}
+
+#ifdef CONFIG_POOL
+struct _prmdir {
+	const struct fsop_opts *opts;
+	struct pool *pool;
+	pthread_mutex_t lock;
+	int errors;
+	int errsv;
+};
+
+struct _prmdir_node {
+	struct _prmdir *ctx;
+	struct _prmdir_node *parent;
+	volatile unsigned int refs;	/* The scan of this directory, plus one per subdirectory */
+	char path[1];
+};
+
+static void _prmdir_error(struct _prmdir *ctx, int errsv) {
+	pthread_mutex_lock(&ctx->lock);
+
+	if (!ctx->errors ++)
+		ctx->errsv = errsv;
+
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void _prmdir_put(struct _prmdir_node *node) {
+	struct _prmdir_node *parent = NULL;
+
+	/* The last reference is dropped once the directory was scanned and all its
+	 * subdirectories were removed, so it is now empty.
+	 */
+	for ( ; node && !__sync_sub_and_fetch(&node->refs, 1); node = parent) {
+		STATS_INC(FSOP_STAT_SYS_RMDIR);
+
+		if (rmdir(node->path) < 0)
+			_prmdir_error(node->ctx, errno);
+
+		parent = node->parent;
+
+		mm_free(node);
+	}
+}
+
+static void _prmdir_dir(void *arg);
+
+static int _prmdir_submit(struct _prmdir *ctx, struct _prmdir_node *parent, const char *path) {
+	struct _prmdir_node *node = NULL;
+	size_t len = strlen(path) + 1;
+
+	if (!(node = mm_alloc(sizeof(struct _prmdir_node) + len)))
+		return -1;
+
+	node->ctx = ctx;
+	node->parent = parent;
+	node->refs = 1;
+
+	memcpy(node->path, path, len);
+
+	if (parent)
+		__sync_add_and_fetch(&parent->refs, 1);
+
+	if (pool_submit(ctx->pool, &_prmdir_dir, node) < 0) {
+		if (parent)
+			__sync_sub_and_fetch(&parent->refs, 1);
+
+		mm_free(node);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _prmdir_action(int order, struct fsop_walk_entry *e, void *arg) {
+	int type = 0;
+	struct _prmdir_node *node = arg;
+
+	if (order != FSOP_WALK_INORDER)
+		return 0;
+
+	/* Symbolic links are removed, never followed. Failures are recorded and
+	 * the walk goes on, so everything that can be removed is removed.
+	 */
+	if ((type = _walk_entry_type(e, 0, _walk_flags(node->ctx->opts))) < 0) {
+		_prmdir_error(node->ctx, errno);
+		return 0;
+	}
+
+	if (type == FSOP_WALK_TYPE_DIR) {
+		if (_walk_entry_paths(e) < 0)
+			return -1;
+
+		return _prmdir_submit(node->ctx, node, e->fpath);
+	}
+
+	STATS_INC(FSOP_STAT_SYS_UNLINK);
+
+	if (unlinkat(e->dirfd, e->name, 0) < 0)
+		_prmdir_error(node->ctx, errno);
+
+	return 0;
+}
+
+static void _prmdir_dir(void *arg) {
+	struct _prmdir_node *node = arg;
+
+	if (_fsop_walk(WALK_CWD, node->path, node->path, NULL, 0, node->ctx->opts, &_prmdir_action, node) < 0)
+		_prmdir_error(node->ctx, errno);
+
+	_prmdir_put(node);
+}
+
+static int _prmdir(const char *dir, const struct fsop_opts *opts) {
+	struct _prmdir ctx;
+
+	memset(&ctx, 0, sizeof(struct _prmdir));
+
+	ctx.opts = opts;
+
+	if (!(ctx.pool = pool_create(opts->threads)))
+		return -1;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	if (_prmdir_submit(&ctx, NULL, dir) < 0)
+		_prmdir_error(&ctx, errno);
+
+	pool_wait(ctx.pool);
+	pool_destroy(ctx.pool);
+
+	pthread_mutex_destroy(&ctx.lock);
+
+	if (ctx.errors) {
+		errno = ctx.errsv;
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+static int _fsop_rmdir(const char *dir, const struct fsop_opts *opts) {
+#ifdef CONFIG_POOL
+	if (opts->threads > 1)
+		return _prmdir(dir, opts);
+#endif
+
+	return _rmdir_tree(WALK_CWD, dir, dir, opts);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_rmdir_ext(const char *dir, const struct fsop_opts *opts) {
+	int ret = 0;
+	struct progress pg;
+	struct fsop_opts popts;
+
+	opts = progress_begin(&pg, &popts, opts);
+
+	ret = _fsop_rmdir(dir, opts);
+
+	CACHE_INVALIDATE_TREE(dir);
+
+	return progress_end(&pg, opts, ret);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_rmdir(const char *dir) {
+	int ret = 0;
+
+	ret = _rmdir_tree(WALK_CWD, dir, dir, NULL);
+
+	CACHE_INVALIDATE_TREE(dir);
+
+	return ret;
+}
+
+static int _fsop_mvdir(const char *src, const char *dest, const struct fsop_opts *opts) {
+	STATS_INC(FSOP_STAT_SYS_RENAME);
+
+	if (!rename(src, dest))
+		return durable_entry(opts, dest) < 0 || durable_entry(opts, src) < 0 ? -1 : 0;
+
+	if (fsop_path_exists(dest)) {
+		/* Must be an empty directory */
+		STATS_INC(FSOP_STAT_SYS_RMDIR);
+
+		if (rmdir(dest) < 0)
+			return -1;
+	}
+
+	if (fsop_cpdir_ext(src, dest, opts) < 0)
+		return -1;
+
+	if (fsop_rmdir_ext(src, opts) < 0)
+		return -1;
+
+	return durable_entry(opts, src);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_mvdir_ext(const char *src, const char *dest, const struct fsop_opts *opts) {
+	int ret = 0;
+	struct progress pg;
+	struct durable dg;
+	struct fsop_opts popts, dopts;
+
+	opts = progress_begin(&pg, &popts, opts);
+	opts = durable_begin(&dg, &dopts, opts);
+
+	ret = _fsop_mvdir(src, dest, opts);
+
+	CACHE_INVALIDATE_TREE(src);
+	CACHE_INVALIDATE_TREE(dest);
+
+	return progress_end(&pg, opts, durable_end(&dg, opts, ret));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_mvdir(const char *src, const char *dest, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_mvdir_ext(src, dest, &opts);
+}
+
@@ -0,0 +1,334 @@
+/**
+ * @file direct.c
+ * @brief File System Operations Library (libfsop)
+ *        Direct I/O Copy Engine
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mm.h"
+#include "engine.h"
+#include "file.h"
+#include "stats.h"
+
+#ifdef CONFIG_DIRECT
+#include <pthread.h>
+
+/* Offset, length and buffer alignment satisfying any logical block size */
+#define DIRECT_ALIGN		4096
+
+/* Buffers of the double buffering scheme */
+#define DIRECT_SLOTS		2
+
+struct _direct_slot {
+	struct mm_buf buf;
+	ssize_t len;		/* Bytes read, or -1 on error */
+	int errsv;
+	int full;		/* Set while waiting to be written */
+};
+
+struct _direct {
+	int sfd;
+	off_t soff;		/* Next offset to be read */
+	size_t size;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct _direct_slot slot[DIRECT_SLOTS];
+};
+
+static ssize_t _direct_read(int fd, char *buf, size_t len, off_t off) {
+	ssize_t ret = 0;
+	size_t done = 0;
+
+	while (done < len) {
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = pread(fd, buf + done, len - done, off + done)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		done += ret;
+
+		/* Only the end of file yields an unaligned or empty read */
+		if (!ret || done % DIRECT_ALIGN)
+			break;
+	}
+
+	return done;
+}
+
+static int _direct_write(int fd, int *fl, const char *buf, size_t len, off_t off) {
+	ssize_t ret = 0;
+	size_t done = 0;
+
+	while (done < len) {
+		/* The unaligned tail of the file can't be written directly */
+		if ((len - done) < DIRECT_ALIGN && (*fl & O_DIRECT)) {
+			if (fcntl(fd, F_SETFL, *fl & ~O_DIRECT) < 0)
+				return -1;
+
+			*fl &= ~O_DIRECT;
+		}
+
+		STATS_INC(FSOP_STAT_SYS_WRITE);
+
+		if ((ret = pwrite(fd, buf + done, (*fl & O_DIRECT) ? (len - done) & ~(size_t) (DIRECT_ALIGN - 1) : len - done, off + done)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		done += ret;
+	}
+
+	return 0;
+}
+
+/* Reads the next chunk of the source into 'slot'. Returns non-zero at the end. */
+static int _direct_fill(struct _direct *d, struct _direct_slot *slot) {
+	ssize_t ret = _direct_read(d->sfd, slot->buf.ptr, d->size, d->soff);
+	int errsv = errno;
+
+	pthread_mutex_lock(&d->lock);
+
+	slot->len = ret;
+	slot->errsv = ret < 0 ? errsv : 0;
+	slot->full = 1;
+
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+
+	if (ret > 0)
+		d->soff += ret;
+
+	return ret < (ssize_t) d->size;
+}
+
+static void *_direct_reader(void *arg) {
+	unsigned int i = 0;
+	struct _direct *d = arg;
+	struct _direct_slot *slot = NULL;
+
+	for (i = 0; ; i = (i + 1) % DIRECT_SLOTS) {
+		slot = &d->slot[i];
+
+		/* Waits for the writer to drain this buffer */
+		pthread_mutex_lock(&d->lock);
+
+		while (slot->full && !d->stop)
+			pthread_cond_wait(&d->cond, &d->lock);
+
+		if (d->stop) {
+			pthread_mutex_unlock(&d->lock);
+			break;
+		}
+
+		pthread_mutex_unlock(&d->lock);
+
+		if (_direct_fill(d, slot))
+			break;
+	}
+
+	return NULL;
+}
+
+/* Descriptor flag changes are not counted, as elsewhere in the library */
+static int _direct_setfl(int fd, int *fl) {
+	if ((*fl = fcntl(fd, F_GETFL)) < 0)
+		return -1;
+
+	/* File systems without direct I/O support refuse the flag */
+	if (fcntl(fd, F_SETFL, *fl | O_DIRECT) < 0)
+		return -1;
+
+	return 0;
+}
+
+int engine_direct(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0, threaded = 0, sfl = -1, dfl = -1, fl = 0, last = 0;
+	unsigned int i = 0;
+	off_t sbase = 0, dbase = 0, doff = 0;
+	size_t done = 0;
+	struct stat st;
+	struct _direct d;
+	struct _direct_slot *slot = NULL;
+	struct checksum *ck = engine_checksum_get();
+	pthread_t reader;
+
+	memset(&d, 0, sizeof(struct _direct));
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (fstat(sfd, &st) < 0 || (sbase = lseek(sfd, 0, SEEK_CUR)) < 0 || (dbase = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	/* Refused, so a buffered engine copies it instead */
+	if ((sbase | dbase) & (DIRECT_ALIGN - 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	d.sfd = sfd;
+	d.soff = sbase;
+	d.size = (opts->block + DIRECT_ALIGN - 1) & ~(size_t) (DIRECT_ALIGN - 1);
+
+	if (!d.size)
+		d.size = DIRECT_ALIGN;
+
+	for (i = 0; i < DIRECT_SLOTS; i ++) {
+		/* Pool buffers are page aligned */
+		if (mm_buf_get(&d.slot[i].buf, d.size) < 0)
+			goto _error;
+	}
+
+	if (_direct_setfl(sfd, &sfl) < 0 || _direct_setfl(dfd, &dfl) < 0)
+		goto _error;
+
+	fl = dfl | O_DIRECT;
+
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.cond, NULL);
+
+	/* Files fitting a single buffer gain nothing from a reader thread */
+	threaded = st.st_size - sbase > (off_t) d.size && !pthread_create(&reader, NULL, &_direct_reader, &d);
+
+	for (i = 0, doff = dbase; !last; i = (i + 1) % DIRECT_SLOTS) {
+		slot = &d.slot[i];
+
+		if (!threaded)
+			last = _direct_fill(&d, slot);
+
+		pthread_mutex_lock(&d.lock);
+
+		while (!slot->full)
+			pthread_cond_wait(&d.cond, &d.lock);
+
+		pthread_mutex_unlock(&d.lock);
+
+		if (slot->len < 0) {
+			errno = slot->errsv;
+			goto _error_sync;
+		}
+
+		last = last || slot->len < (ssize_t) d.size;
+
+		if (ck)
+			checksum_update(ck, slot->buf.ptr, slot->len);
+
+		if (_direct_write(dfd, &fl, slot->buf.ptr, slot->len, doff) < 0)
+			goto _error_sync;
+
+		doff += slot->len;
+		done += slot->len;
+
+		pthread_mutex_lock(&d.lock);
+
+		slot->full = 0;
+
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.lock);
+
+		if (engine_progress(opts, slot->len) < 0)
+			goto _error_sync;
+	}
+
+	if (threaded)
+		pthread_join(reader, NULL);
+
+	pthread_cond_destroy(&d.cond);
+	pthread_mutex_destroy(&d.lock);
+
+	/* Leave both offsets as a regular transfer would */
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (lseek(sfd, d.soff, SEEK_SET) < 0 || lseek(dfd, doff, SEEK_SET) < 0)
+		goto _error;
+
+	fcntl(sfd, F_SETFL, sfl);
+	fcntl(dfd, F_SETFL, dfl);
+
+	for (i = 0; i < DIRECT_SLOTS; i ++)
+		mm_buf_put(&d.slot[i].buf);
+
+	*count += done;
+
+	return 0;
+
+_error_sync:
+	errsv = errno;
+
+	if (threaded) {
+		pthread_mutex_lock(&d.lock);
+		d.stop = 1;
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.lock);
+
+		pthread_join(reader, NULL);
+	}
+
+	pthread_cond_destroy(&d.cond);
+	pthread_mutex_destroy(&d.lock);
+
+	errno = errsv;
+_error:
+	errsv = errno;
+
+	if (sfl >= 0)
+		fcntl(sfd, F_SETFL, sfl);
+
+	if (dfl >= 0)
+		fcntl(dfd, F_SETFL, dfl);
+
+	for (i = 0; i < DIRECT_SLOTS; i ++) {
+		if (d.slot[i].buf.ptr)
+			mm_buf_put(&d.slot[i].buf);
+	}
+
+	/* File offsets were never moved, so the next engine restarts from the
+	 * beginning of the transfer.
+	 */
+	engine_rewind(opts, done);
+
+	errno = errsv;
+
+	return -1;
+}
+#endif
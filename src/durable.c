@@ -0,0 +1,287 @@
+/**
+ * @file durable.c
+ * @brief File System Operations Library (libfsop)
+ *        Durability interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mm.h"
+#include "stats.h"
+#include "durable.h"
+
+/* Initial size of the directory set, which doubles when half full */
+#define DURABLE_SET_SIZE	64
+
+/* Devices remembered as already synced, before syncing again */
+#define DURABLE_DEVS		16
+
+#ifndef COMPILE_WIN32
+static size_t _durable_hash(const char *path, size_t len) {
+	size_t i = 0;
+	unsigned long long h = 14695981039346656037ULL;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i ++)
+		h = (h ^ (unsigned char) path[i]) * 1099511628211ULL;
+
+	return (size_t) h;
+}
+
+/* Must be called with the tracker locked */
+static int _durable_grow(struct durable *dg) {
+	size_t i = 0, j = 0, size = dg->size ? dg->size * 2 : DURABLE_SET_SIZE;
+	char **dirs = NULL;
+
+	if (!(dirs = mm_calloc(size, sizeof(char *))))
+		return -1;
+
+	for (i = 0; i < dg->size; i ++) {
+		if (!dg->dirs[i])
+			continue;
+
+		for (j = _durable_hash(dg->dirs[i], strlen(dg->dirs[i])) % size; dirs[j]; j = (j + 1) % size)
+			;
+
+		dirs[j] = dg->dirs[i];
+	}
+
+	mm_free(dg->dirs);
+
+	dg->dirs = dirs;
+	dg->size = size;
+
+	return 0;
+}
+
+/* Must be called with the tracker locked */
+static int _durable_add(struct durable *dg, const char *dir, size_t len) {
+	size_t i = 0;
+
+	if ((dg->count + 1) * 2 > dg->size && _durable_grow(dg) < 0)
+		return -1;
+
+	for (i = _durable_hash(dir, len) % dg->size; dg->dirs[i]; i = (i + 1) % dg->size) {
+		if (!strncmp(dg->dirs[i], dir, len) && !dg->dirs[i][len])
+			return 0;
+	}
+
+	if (!(dg->dirs[i] = mm_alloc(len + 1)))
+		return -1;
+
+	memcpy(dg->dirs[i], dir, len);
+	dg->dirs[i][len] = 0;
+
+	dg->count ++;
+
+	return 0;
+}
+
+static int _durable_sync_dir(const char *dir, dev_t *devs, unsigned int *ndevs, int mode) {
+	int fd = 0, errsv = 0;
+	unsigned int i = 0;
+	struct stat st;
+
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+	if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+		return errno == ENOENT ? 0 : -1;	/* Removed by the operation itself */
+
+	if (mode == FSOP_DURABILITY_BATCH) {
+		STATS_INC(FSOP_STAT_SYS_STAT);
+
+		if (fstat(fd, &st) < 0)
+			goto _error;
+
+		for (i = 0; i < *ndevs && devs[i] != st.st_dev; i ++)
+			;
+
+		/* One flush of each file system written by the operation */
+		if (i == *ndevs) {
+			STATS_INC(FSOP_STAT_SYS_SYNC);
+
+#ifdef __linux__
+			if (syncfs(fd) < 0)
+				goto _error;
+#else
+			sync();
+#endif
+
+			if (*ndevs < DURABLE_DEVS)
+				devs[(*ndevs) ++] = st.st_dev;
+		}
+	}
+
+	STATS_INC(FSOP_STAT_SYS_SYNC);
+
+	/* Some file systems don't support syncing directories */
+	if (fsync(fd) < 0 && errno != EINVAL)
+		goto _error;
+
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
+
+	close(fd);
+
+	return 0;
+
+_error:
+	errsv = errno;
+
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
+
+	close(fd);
+
+	errno = errsv;
+
+	return -1;
+}
+#endif
+
+const struct fsop_opts *durable_begin(struct durable *dg, struct fsop_opts *copy, const struct fsop_opts *opts) {
+#ifndef COMPILE_WIN32
+	/* Nothing to sync, or already tracked by an outer operation */
+	if (opts->durability == FSOP_DURABILITY_NONE || opts->_durable)
+		return opts;
+
+	memset(dg, 0, sizeof(struct durable));
+
+	pthread_mutex_init(&dg->lock, NULL);
+
+	dg->mode = opts->durability;
+
+	*copy = *opts;
+	copy->_durable = dg;
+
+	return copy;
+#else
+	(void) dg;
+	(void) copy;
+
+	return opts;
+#endif
+}
+
+ssize_t durable_end(struct durable *dg, const struct fsop_opts *opts, ssize_t ret) {
+#ifndef COMPILE_WIN32
+	int errsv = errno;
+	size_t i = 0;
+	unsigned int ndevs = 0;
+	dev_t devs[DURABLE_DEVS];
+
+	if (opts->_durable != dg)
+		return ret;
+
+	for (i = 0; i < dg->size; i ++) {
+		if (!dg->dirs[i])
+			continue;
+
+		/* A failed operation has nothing worth flushing */
+		if (ret >= 0 && _durable_sync_dir(dg->dirs[i], devs, &ndevs, dg->mode) < 0) {
+			errsv = errno;
+			ret = -1;
+		}
+
+		mm_free(dg->dirs[i]);
+	}
+
+	mm_free(dg->dirs);
+
+	pthread_mutex_destroy(&dg->lock);
+
+	errno = errsv;
+#else
+	(void) dg;
+	(void) opts;
+#endif
+
+	return ret;
+}
+
+int durable_file(const struct fsop_opts *opts, int fd, const char *path) {
+#ifndef COMPILE_WIN32
+	struct durable *dg = opts->_durable;
+
+	if (!dg)
+		return 0;
+
+	STATS_INC(FSOP_STAT_SYS_SYNC);
+
+	if (dg->mode == FSOP_DURABILITY_FILE) {
+		if (fdatasync(fd) < 0)
+			return -1;
+	} else {
+#ifdef SYNC_FILE_RANGE_WRITE
+		/* Only starts the write-out, which the final flush waits for */
+		sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+	}
+
+	return durable_entry(opts, path);
+#else
+	(void) opts;
+	(void) fd;
+	(void) path;
+
+	return 0;
+#endif
+}
+
+int durable_entry(const struct fsop_opts *opts, const char *path) {
+#ifndef COMPILE_WIN32
+	int ret = 0;
+	const char *base = strrchr(path, '/');
+	struct durable *dg = opts->_durable;
+
+	if (!dg)
+		return 0;
+
+	pthread_mutex_lock(&dg->lock);
+
+	/* The directory holding the entry */
+	if (!base)
+		ret = _durable_add(dg, ".", 1);
+	else
+		ret = _durable_add(dg, path, base == path ? 1 : (size_t) (base - path));
+
+	pthread_mutex_unlock(&dg->lock);
+
+	return ret;
+#else
+	(void) opts;
+	(void) path;
+
+	return 0;
+#endif
+}
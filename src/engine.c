@@ -0,0 +1,1015 @@
+/**
+ * @file engine.c
+ * @brief File System Operations Library (libfsop)
+ *        Copy Engines interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <sys/sendfile.h>
+ #include <linux/fs.h>
+#endif
+
+#include "config.h"
+#include "mm.h"
+#include "engine.h"
+#include "file.h"
+#include "stats.h"
+#include "progress.h"
+
+/* Maximum amount of data requested on each in-kernel transfer */
+#define ENGINE_CHUNK_MAX	(1UL << 30)
+
+/* Pipe capacity requested for splice() transfers */
+#define ENGINE_PIPE_SIZE	(1UL << 20)
+
+/* Data written between page cache hints in no-cache mode */
+#define ENGINE_STREAM_WINDOW	(8UL << 20)
+
+static __thread int _engine_last = FSOP_ENGINE_AUTO;
+static __thread struct checksum *_engine_checksum = NULL;
+static __thread struct engine_stream *_engine_stream = NULL;
+
+#ifdef __linux__
+/* Set by whichever thread first meets ENOSYS, so accessed atomically */
+static int _engine_cfr_nosys = 0;
+static int _engine_splice_nosys = 0;
+#endif
+
+#ifdef __linux__
+static size_t _engine_chunk(const struct fsop_opts *opts) {
+	size_t chunk = ENGINE_CHUNK_MAX;
+
+	/* Progress reports and page cache hints are issued between in-kernel
+	 * transfers.
+	 */
+	if (opts->_progress && opts->progress_bytes && opts->progress_bytes < chunk)
+		chunk = opts->progress_bytes;
+
+	if (_engine_stream && ENGINE_STREAM_WINDOW < chunk)
+		chunk = ENGINE_STREAM_WINDOW;
+
+	return chunk;
+}
+#endif
+
+static int _engine_write_full(int fd, const char *buf, size_t len) {
+	ssize_t ret = 0;
+
+	while (len) {
+		STATS_INC(FSOP_STAT_SYS_WRITE);
+
+		if ((ret = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int _engine_is_zero(const char *buf, size_t len) {
+	return !buf[0] && !memcmp(buf, buf + 1, len - 1);
+}
+
+static int _engine_extend(int fd, off_t size) {
+	struct stat st;
+
+	/* Materialize a trailing hole, left behind by skipped writes */
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if (st.st_size >= size)
+		return 0;
+
+	STATS_INC(FSOP_STAT_SYS_TRUNCATE);
+
+	return ftruncate(fd, size);
+}
+
+static int _engine_hole(int dfd, off_t off, off_t len, off_t dsize, char **zbuf, size_t block) {
+	size_t n = 0;
+	ssize_t ret = 0;
+
+	/* Regions past the original end of the destination are already holes */
+	if (off >= dsize || len <= 0)
+		return 0;
+
+	if (off + len > dsize)
+		len = dsize - off;
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	STATS_INC(FSOP_STAT_SYS_FALLOCATE);
+
+	if (!fallocate(dfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len))
+		return 0;
+#endif
+
+	/* Hole punching not supported. Overwrite the stale data with zeros. */
+	if (!*zbuf && !(*zbuf = mm_calloc(1, block)))
+		return -1;
+
+	while (len > 0) {
+		n = (off_t) block < len ? block : (size_t) len;
+
+		STATS_INC(FSOP_STAT_SYS_WRITE);
+
+		if ((ret = pwrite(dfd, *zbuf, n, off)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		off += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+int engine_rdwr(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0, holes = 0, skipped = 0;
+	ssize_t ret = 0;
+	off_t off = 0;
+	char *buf = NULL;
+	struct stat st;
+	struct mm_buf mb;
+
+	if (opts->flags & FSOP_OPT_ZERO_HOLES) {
+		STATS_INC(FSOP_STAT_SYS_STAT);
+
+		holes = !fstat(dfd, &st) && S_ISREG(st.st_mode);
+	}
+
+	if (mm_buf_get(&mb, opts->block) < 0)
+		return -1;
+
+	buf = mb.ptr;
+
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = read(sfd, buf, opts->block)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		if (!ret)
+			break;
+
+		if (_engine_checksum)
+			checksum_update(_engine_checksum, buf, ret);
+
+		if (holes && _engine_is_zero(buf, ret)) {
+			STATS_INC(FSOP_STAT_SYS_SEEK);
+
+			if ((off = lseek(dfd, ret, SEEK_CUR)) < 0)
+				goto _error;
+
+			skipped = 1;
+		} else {
+			if (_engine_write_full(dfd, buf, ret) < 0)
+				goto _error;
+
+			skipped = 0;
+		}
+
+		*count += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			goto _error;
+	}
+
+	if (skipped && _engine_extend(dfd, off) < 0)
+		goto _error;
+
+	mm_buf_put(&mb);
+
+	return 0;
+
+_error:
+	errsv = errno;
+	mm_buf_put(&mb);
+	errno = errsv;
+	return -1;
+}
+
+#ifndef COMPILE_WIN32
+int engine_delta(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0;
+	ssize_t ret = 0, dret = 0, n = 0;
+	off_t doff = 0, dsize = 0;
+	struct stat st;
+	struct mm_buf sbuf, dbuf;
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+	STATS_INC(FSOP_STAT_SYS_SEEK);
+
+	if (fstat(dfd, &st) < 0 || (doff = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	dsize = st.st_size;
+
+	if (mm_buf_get(&sbuf, opts->block) < 0)
+		return -1;
+
+	if (mm_buf_get(&dbuf, opts->block) < 0) {
+		errsv = errno;
+		mm_buf_put(&sbuf);
+		errno = errsv;
+		return -1;
+	}
+
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = read(sfd, sbuf.ptr, opts->block)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		if (!ret)
+			break;
+
+		if (_engine_checksum)
+			checksum_update(_engine_checksum, sbuf.ptr, ret);
+
+		/* Blocks past the end of the destination always differ */
+		dret = 0;
+
+		if (doff < dsize) {
+			STATS_INC(FSOP_STAT_SYS_READ);
+
+			if ((dret = pread(dfd, dbuf.ptr, ret, doff)) < 0)
+				goto _error;
+		}
+
+		if (dret == ret && !memcmp(sbuf.ptr, dbuf.ptr, ret)) {
+			STATS_ADD(FSOP_STAT_BYTES_UNCHANGED, ret);
+		} else {
+			for (n = 0; n < ret; n += dret) {
+				STATS_INC(FSOP_STAT_SYS_WRITE);
+
+				if ((dret = pwrite(dfd, (char *) sbuf.ptr + n, ret - n, doff + n)) < 0) {
+					if (errno == EINTR) {
+						dret = 0;
+						continue;
+					}
+
+					goto _error;
+				}
+			}
+
+			STATS_ADD(FSOP_STAT_BYTES_REWRITTEN, ret);
+		}
+
+		*count += ret;
+		doff += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			goto _error;
+	}
+
+	/* Drop whatever the source no longer has */
+	if (dsize > doff) {
+		STATS_INC(FSOP_STAT_SYS_TRUNCATE);
+
+		if (ftruncate(dfd, doff) < 0)
+			goto _error;
+	}
+
+	STATS_INC(FSOP_STAT_SYS_SEEK);
+
+	if (lseek(dfd, doff, SEEK_SET) < 0)
+		goto _error;
+
+	mm_buf_put(&dbuf);
+	mm_buf_put(&sbuf);
+
+	return 0;
+
+_error:
+	errsv = errno;
+	mm_buf_put(&dbuf);
+	mm_buf_put(&sbuf);
+	errno = errsv;
+	return -1;
+}
+#endif
+
+int engine_clone(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+#ifdef FICLONE
+	struct stat st;
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	if (fstat(sfd, &st) < 0)
+		return -1;
+
+	STATS_INC(FSOP_STAT_SYS_CLONE);
+
+	if (ioctl(dfd, FICLONE, sfd) < 0)
+		return -1;
+
+	/* Leave both offsets as a regular transfer would */
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (lseek(sfd, st.st_size, SEEK_SET) < 0 || lseek(dfd, st.st_size, SEEK_SET) < 0)
+		return -1;
+
+	*count += st.st_size;
+
+	return engine_progress(opts, st.st_size);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static int _engine_range(
+		int sfd,
+		int dfd,
+		off_t soff,
+		off_t doff,
+		off_t len,
+		off_t dsize,
+		const struct fsop_opts *opts,
+		struct mm_buf *buf,
+		char **zbuf,
+		int *engine,
+		size_t *done)
+{
+	ssize_t ret = 0, wret = 0, n = 0;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	loff_t so = soff, doff64 = doff;
+
+	if (!(opts->flags & FSOP_OPT_ZERO_HOLES) && !__atomic_load_n(&_engine_cfr_nosys, __ATOMIC_RELAXED) &&
+			(opts->engine == FSOP_ENGINE_AUTO || opts->engine == FSOP_ENGINE_COPY_FILE_RANGE))
+	{
+		while (len > 0) {
+			STATS_INC(FSOP_STAT_SYS_COPY_FILE_RANGE);
+
+			if ((ret = syscall(SYS_copy_file_range, sfd, &so, dfd, &doff64, len < (off_t) _engine_chunk(opts) ? (size_t) len : _engine_chunk(opts), 0)) < 0) {
+				if (errno == EINTR)
+					continue;
+
+				if (!engine_refused(errno))
+					return -1;
+
+				if (errno == ENOSYS)
+					__atomic_store_n(&_engine_cfr_nosys, 1, __ATOMIC_RELAXED);
+
+				break;
+			}
+
+			/* Source was truncated while being copied */
+			if (!ret)
+				return 0;
+
+			len -= ret;
+			*engine = FSOP_ENGINE_COPY_FILE_RANGE;
+
+			*done += ret;
+
+			if (engine_progress(opts, ret) < 0)
+				return -1;
+		}
+
+		soff = so;
+		doff = doff64;
+	}
+#endif
+
+	if (len <= 0)
+		return 0;
+
+	if (!buf->ptr && mm_buf_get(buf, opts->block) < 0)
+		return -1;
+
+	*engine = FSOP_ENGINE_RDWR;
+
+	while (len > 0) {
+		n = len < (off_t) opts->block ? len : (off_t) opts->block;
+
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = pread(sfd, buf->ptr, n, soff)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (!ret)
+			return 0;
+
+		if ((opts->flags & FSOP_OPT_ZERO_HOLES) && _engine_is_zero(buf->ptr, ret)) {
+			if (_engine_hole(dfd, doff, ret, dsize, zbuf, opts->block) < 0)
+				return -1;
+		} else {
+			for (n = 0; n < ret; n += wret) {
+				STATS_INC(FSOP_STAT_SYS_WRITE);
+
+				if ((wret = pwrite(dfd, (char *) buf->ptr + n, ret - n, doff + n)) < 0) {
+					if (errno == EINTR) {
+						wret = 0;
+						continue;
+					}
+
+					return -1;
+				}
+			}
+		}
+
+		soff += ret;
+		doff += ret;
+		len -= ret;
+
+		*done += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int engine_sparse(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+#ifdef SEEK_DATA
+	int errsv = 0, engine = FSOP_ENGINE_RDWR;
+	off_t sbase = 0, dbase = 0, data = 0, hole = 0, end = 0;
+	size_t done = 0;
+	char *zbuf = NULL;
+	struct stat sst, dst;
+	struct mm_buf buf;
+
+	buf.ptr = NULL;
+
+	STATS_ADD(FSOP_STAT_SYS_STAT, 2);
+
+	if (fstat(sfd, &sst) < 0 || fstat(dfd, &dst) < 0)
+		return -1;
+
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if ((sbase = lseek(sfd, 0, SEEK_CUR)) < 0 || (dbase = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	end = sst.st_size;
+
+	/* Walk the data extents of the source, skipping the holes between them */
+	for (hole = sbase; hole < end; ) {
+		STATS_INC(FSOP_STAT_SYS_SEEK);
+
+		if ((data = lseek(sfd, hole, SEEK_DATA)) < 0) {
+			/* Only a trailing hole remains */
+			if (errno == ENXIO)
+				break;
+
+			goto _error;
+		}
+
+		if (data >= end)
+			break;
+
+		if (_engine_hole(dfd, dbase + hole - sbase, data - hole, dst.st_size, &zbuf, opts->block) < 0)
+			goto _error;
+
+		done += data - hole;
+
+		if (engine_progress(opts, data - hole) < 0)
+			goto _error;
+
+		STATS_INC(FSOP_STAT_SYS_SEEK);
+
+		if ((hole = lseek(sfd, data, SEEK_HOLE)) < 0)
+			goto _error;
+
+		if (hole > end)
+			hole = end;
+
+		if (_engine_range(sfd, dfd, data, dbase + data - sbase, hole - data, dst.st_size, opts, &buf, &zbuf, &engine, &done) < 0)
+			goto _error;
+	}
+
+	if (hole < end) {
+		if (_engine_hole(dfd, dbase + hole - sbase, end - hole, dst.st_size, &zbuf, opts->block) < 0)
+			goto _error;
+
+		done += end - hole;
+
+		if (engine_progress(opts, end - hole) < 0)
+			goto _error;
+	}
+
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (lseek(sfd, end, SEEK_SET) < 0 || lseek(dfd, dbase + end - sbase, SEEK_SET) < 0)
+		goto _error;
+
+	if (_engine_extend(dfd, dbase + end - sbase) < 0)
+		goto _error;
+
+	if (buf.ptr)
+		mm_buf_put(&buf);
+
+	if (zbuf)
+		mm_free(zbuf);
+
+	if (end > sbase)
+		*count += end - sbase;
+
+	engine_last_set(engine);
+
+	return 0;
+
+_error:
+	errsv = errno;
+
+	if (buf.ptr)
+		mm_buf_put(&buf);
+
+	if (zbuf)
+		mm_free(zbuf);
+
+	/* Leave the offsets where they were, so a fallback engine can restart
+	 * the transfer from its beginning.
+	 */
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	lseek(sfd, sbase, SEEK_SET);
+	lseek(dfd, dbase, SEEK_SET);
+
+	engine_rewind(opts, done);
+
+	errno = errsv;
+
+	return -1;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+#ifdef __linux__
+int engine_copy_file_range(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+#ifdef SYS_copy_file_range
+	ssize_t ret = 0;
+
+	if (__atomic_load_n(&_engine_cfr_nosys, __ATOMIC_RELAXED)) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	/* Call the system call directly, as some libc versions emulate it in
+	 * userspace, which is exactly what this engine is meant to avoid.
+	 */
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_COPY_FILE_RANGE);
+
+		if ((ret = syscall(SYS_copy_file_range, sfd, NULL, dfd, NULL, _engine_chunk(opts), 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == ENOSYS)
+				__atomic_store_n(&_engine_cfr_nosys, 1, __ATOMIC_RELAXED);
+
+			return -1;
+		}
+
+		if (!ret)
+			break;
+
+		*count += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int engine_sendfile(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	ssize_t ret = 0;
+
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_SENDFILE);
+
+		if ((ret = sendfile(dfd, sfd, NULL, _engine_chunk(opts))) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (!ret)
+			break;
+
+		*count += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int _engine_pipe_drain(int pfd, int dfd, size_t len, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0;
+	ssize_t ret = 0;
+	char *buf = NULL;
+	struct mm_buf mb;
+
+	/* The kernel refused to splice the pipe contents into 'dfd', but that data
+	 * was already consumed from the source, so it must be written by hand
+	 * before the transfer is handed over to the next engine.
+	 */
+	if (mm_buf_get(&mb, len) < 0)
+		return -1;
+
+	buf = mb.ptr;
+
+	while (len) {
+		STATS_INC(FSOP_STAT_SYS_READ);
+
+		if ((ret = read(pfd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		if (_engine_write_full(dfd, buf, ret) < 0)
+			goto _error;
+
+		*count += ret;
+		len -= ret;
+
+		if (engine_progress(opts, ret) < 0)
+			goto _error;
+	}
+
+	mm_buf_put(&mb);
+
+	return 0;
+
+_error:
+	errsv = errno;
+	mm_buf_put(&mb);
+	errno = errsv;
+	return -1;
+}
+
+static int _engine_splice_pipe(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0, pfd[2];
+	ssize_t ret = 0, len = 0, pret = 0;
+	size_t chunk = 0;
+
+	if (pipe(pfd) < 0)
+		return -1;
+
+	if ((pret = fcntl(pfd[1], F_SETPIPE_SZ, ENGINE_PIPE_SIZE)) < 0)
+		pret = fcntl(pfd[1], F_GETPIPE_SZ);
+
+	chunk = pret > 0 ? (size_t) pret : 65536;
+
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_SPLICE);
+
+		if ((len = splice(sfd, NULL, pfd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto _error;
+		}
+
+		if (!len)
+			break;
+
+		while (len) {
+			STATS_INC(FSOP_STAT_SYS_SPLICE);
+
+			if ((ret = splice(pfd[0], NULL, dfd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+				if (errno == EINTR)
+					continue;
+
+				errsv = errno;
+
+				if (engine_refused(errsv) && _engine_pipe_drain(pfd[0], dfd, len, opts, count) < 0)
+					errsv = errno;
+
+				goto _error2;
+			}
+
+			*count += ret;
+			len -= ret;
+
+			if (engine_progress(opts, ret) < 0)
+				goto _error;
+		}
+	}
+
+	STATS_ADD(FSOP_STAT_SYS_CLOSE, 2);
+
+	close(pfd[0]);
+	close(pfd[1]);
+
+	return 0;
+
+_error:
+	errsv = errno;
+_error2:
+	STATS_ADD(FSOP_STAT_SYS_CLOSE, 2);
+
+	close(pfd[0]);
+	close(pfd[1]);
+	errno = errsv;
+	return -1;
+}
+
+int engine_splice(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	ssize_t ret = 0;
+	struct stat sst, dst;
+
+	if (__atomic_load_n(&_engine_splice_nosys, __ATOMIC_RELAXED)) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	STATS_ADD(FSOP_STAT_SYS_STAT, 2);
+
+	if (fstat(sfd, &sst) < 0 || fstat(dfd, &dst) < 0)
+		return -1;
+
+	if (!S_ISFIFO(sst.st_mode) && !S_ISFIFO(dst.st_mode)) {
+		if (_engine_splice_pipe(sfd, dfd, opts, count) < 0) {
+			if (errno == ENOSYS)
+				__atomic_store_n(&_engine_splice_nosys, 1, __ATOMIC_RELAXED);
+
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/* One of the ends is already a pipe, so no intermediate pipe is required */
+	for (;;) {
+		STATS_INC(FSOP_STAT_SYS_SPLICE);
+
+		if ((ret = splice(sfd, NULL, dfd, NULL, _engine_chunk(opts), SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == ENOSYS)
+				__atomic_store_n(&_engine_splice_nosys, 1, __ATOMIC_RELAXED);
+
+			return -1;
+		}
+
+		if (!ret)
+			break;
+
+		*count += ret;
+
+		if (engine_progress(opts, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+#endif
+
+int engine_refused(int errsv) {
+	if (errsv == EXDEV || errsv == EINVAL || errsv == ENOSYS || errsv == EBADF)
+		return 1;
+
+	if (errsv == EOPNOTSUPP || errsv == ENOTSUP || errsv == ENOTTY)
+		return 1;
+
+	return 0;
+}
+
+void engine_last_set(int engine) {
+	_engine_last = engine;
+}
+
+void engine_checksum_set(struct checksum *ck) {
+	_engine_checksum = ck;
+}
+
+struct checksum *engine_checksum_get(void) {
+	return _engine_checksum;
+}
+
+static void _engine_advise(int fd, off_t base, off_t off, off_t len, int advice) {
+#ifdef POSIX_FADV_DONTNEED
+	if (base < 0)
+		return;
+
+	STATS_INC(FSOP_STAT_SYS_FADVISE);
+
+	posix_fadvise(fd, base + off, len, advice);
+#else
+	(void) fd;
+	(void) base;
+	(void) off;
+	(void) len;
+	(void) advice;
+#endif
+}
+
+static void _engine_writeout(struct engine_stream *es, off_t off, off_t len, int wait) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	if (es->dbase < 0)
+		return;
+
+	STATS_INC(FSOP_STAT_SYS_SYNC);
+
+	/* Dirty pages can't be dropped, so the write-out is waited for first */
+	sync_file_range(es->dfd, es->dbase + off, len, wait ? SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER : SYNC_FILE_RANGE_WRITE);
+#else
+	(void) es;
+	(void) off;
+	(void) len;
+	(void) wait;
+#endif
+}
+
+static void _engine_drop(struct engine_stream *es, off_t off, off_t len) {
+#ifdef POSIX_FADV_DONTNEED
+	_engine_writeout(es, off, len, 1);
+	_engine_advise(es->dfd, es->dbase, off, len, POSIX_FADV_DONTNEED);
+	_engine_advise(es->sfd, es->sbase, off, len, POSIX_FADV_DONTNEED);
+#else
+	(void) es;
+	(void) off;
+	(void) len;
+#endif
+}
+
+void engine_stream_begin(struct engine_stream *es, int sfd, int dfd, int drop) {
+	struct stat st;
+
+	memset(es, 0, sizeof(struct engine_stream));
+
+	es->sfd = sfd;
+	es->dfd = dfd;
+	es->drop = drop;
+	es->sbase = -1;
+	es->dbase = -1;
+
+	STATS_ADD(FSOP_STAT_SYS_STAT, 2);
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (!fstat(sfd, &st) && S_ISREG(st.st_mode))
+		es->sbase = lseek(sfd, 0, SEEK_CUR);
+
+	if (!fstat(dfd, &st) && S_ISREG(st.st_mode))
+		es->dbase = lseek(dfd, 0, SEEK_CUR);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	/* Larger read ahead, with pages behind it reclaimed first */
+	if (drop) {
+		_engine_advise(sfd, es->sbase, 0, 0, POSIX_FADV_SEQUENTIAL);
+		_engine_advise(sfd, es->sbase, 0, ENGINE_STREAM_WINDOW, POSIX_FADV_WILLNEED);
+	}
+#endif
+
+	_engine_stream = es;
+}
+
+void engine_stream_end(struct engine_stream *es) {
+	_engine_stream = NULL;
+
+	/* The tail is left to the caller when only writing out */
+	if (!es->drop)
+		return;
+
+	/* The whole range, as verification may have read it back in */
+	if (es->done > es->dropped)
+		_engine_writeout(es, es->dropped, es->done - es->dropped, 1);
+
+#ifdef POSIX_FADV_DONTNEED
+	_engine_advise(es->dfd, es->dbase, 0, 0, POSIX_FADV_DONTNEED);
+	_engine_advise(es->sfd, es->sbase, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+int engine_progress(const struct fsop_opts *opts, size_t n) {
+	off_t prev = 0;
+	struct engine_stream *es = _engine_stream;
+
+	if (es && (es->done += n) - es->started >= (off_t) ENGINE_STREAM_WINDOW) {
+		/* Everything before the previous write-out had a window to complete */
+		prev = es->started;
+
+		_engine_writeout(es, es->started, es->done - es->started, 0);
+
+		es->started = es->done;
+
+		if (es->drop && prev > es->dropped) {
+			_engine_drop(es, es->dropped, prev - es->dropped);
+			es->dropped = prev;
+		}
+
+#ifdef POSIX_FADV_WILLNEED
+		if (es->drop)
+			_engine_advise(es->sfd, es->sbase, es->done, ENGINE_STREAM_WINDOW, POSIX_FADV_WILLNEED);
+#endif
+	}
+
+	return progress_bytes(opts, n);
+}
+
+void engine_rewind(const struct fsop_opts *opts, size_t n) {
+	struct engine_stream *es = _engine_stream;
+
+	if (es) {
+		es->done = es->done > (off_t) n ? es->done - (off_t) n : 0;
+
+		if (es->started > es->done)
+			es->started = es->done;
+
+		if (es->dropped > es->done)
+			es->dropped = es->done;
+	}
+
+	progress_rewind(opts, n);
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_engine_last(void) {
+	return _engine_last;
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+const char *fsop_engine_name(int engine) {
+	switch (engine) {
+		case FSOP_ENGINE_AUTO: return "auto";
+		case FSOP_ENGINE_RDWR: return "rdwr";
+		case FSOP_ENGINE_COPY_FILE_RANGE: return "copy_file_range";
+		case FSOP_ENGINE_SENDFILE: return "sendfile";
+		case FSOP_ENGINE_SPLICE: return "splice";
+		case FSOP_ENGINE_CLONE: return "clone";
+		case FSOP_ENGINE_URING: return "io_uring";
+		case FSOP_ENGINE_DIRECT: return "direct";
+	}
+
+	return "unknown";
+}
@@ -24,10 +24,15 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -36,87 +41,595 @@
 
 #include "config.h"
 #include "mm.h"
+#include "engine.h"
 #include "path.h"
 #include "file.h"
-
+#include "stats.h"
+#include "progress.h"
+#include "cache.h"
+#include "checksum.h"
+#include "durable.h"
+
+/* Read size of content comparisons when no block size was set */
+#define FILE_CMP_BLOCK		65536
+
+/* Attempts at finding an unused temporary name before giving up */
+#define FILE_TMP_TRIES		64
+
+/* Destination being written under a temporary identity */
+struct _fsop_atomic {
+	char *tmp;	/* Hidden temporary name, if any */
+	int anon;	/* Set while an O_TMPFILE has no name */
+};
+
+#ifndef COMPILE_WIN32
+static unsigned int _fsop_atomic_seq = 0;
+#endif
 
 static void _fsop_close_safe(int fd) {
+	STATS_INC(FSOP_STAT_SYS_CLOSE);
+
 	while (close(fd) < 0) {
 		if (errno != EINTR)
 			break;
 	}
 }
 
-static ssize_t _fsop_fxchg(int sfd, int dfd, size_t block) {
-	int errsv = 0, ret = 0;
+static int _fsop_fxchg_try(
+		int engine,
+		int (*xchg) (int, int, const struct fsop_opts *, size_t *),
+		int sfd,
+		int dfd,
+		const struct fsop_opts *opts,
+		size_t *count)
+{
+	size_t prev = *count;
+
+	if (xchg(sfd, dfd, opts, count) < 0)
+		return engine_refused(errno) ? 0 : -1;
+
+	/* Nothing was transferred. Let the next engine confirm the end of file, as
+	 * some special files report no data to in-kernel transfers.
+	 */
+	if (*count == prev)
+		return 0;
+
+	engine_last_set(engine);
+
+	return 1;
+}
+
+static void _fsop_prealloc(int sfd, int dfd, const struct stat *sst) {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+	off_t soff = 0, doff = 0;
+
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if ((soff = lseek(sfd, 0, SEEK_CUR)) < 0 || (doff = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return;
+
+	if (sst->st_size <= soff)
+		return;
+
+	STATS_INC(FSOP_STAT_SYS_FALLOCATE);
+
+	/* Just a hint. The copy itself reports any real problem. */
+	fallocate(dfd, FALLOC_FL_KEEP_SIZE, doff, sst->st_size - soff);
+#else
+	(void) sfd;
+	(void) dfd;
+	(void) sst;
+#endif
+}
+
+static ssize_t _fsop_fxchg_engines(int sfd, int dfd, const struct fsop_opts *opts) {
+	int engine = opts->engine, clone = opts->clone, regular = 0;
+#if defined(__linux__) || defined(CONFIG_DIRECT)
+	int ret = 0;
+#endif
+	size_t count = 0;
+	struct stat sst, dst;
+
+	/* The clone engine is a clone mode, falling back to the other engines */
+	if (engine == FSOP_ENGINE_CLONE) {
+		if (clone == FSOP_CLONE_NEVER)
+			clone = FSOP_CLONE_AUTO;
+
+		engine = FSOP_ENGINE_AUTO;
+	}
+
+	if (engine != FSOP_ENGINE_RDWR || clone != FSOP_CLONE_NEVER || (opts->flags & (FSOP_OPT_SPARSE | FSOP_OPT_ZERO_HOLES | FSOP_OPT_DELTA | FSOP_OPT_PREALLOC))) {
+		STATS_ADD(FSOP_STAT_SYS_STAT, 2);
+
+		if (fstat(sfd, &sst) < 0 || fstat(dfd, &dst) < 0)
+			return -1;
+
+		regular = S_ISREG(sst.st_mode) && S_ISREG(dst.st_mode);
+	}
+
+#ifndef COMPILE_WIN32
+	/* Existing destinations are updated in place */
+	if ((opts->flags & FSOP_OPT_DELTA) && regular && dst.st_size) {
+		if (engine_delta(sfd, dfd, opts, &count) < 0)
+			return -1;
+
+		engine_last_set(FSOP_ENGINE_RDWR);
+
+		return count;
+	}
+#endif
+
+	if (clone != FSOP_CLONE_NEVER) {
+		if (regular && !engine_clone(sfd, dfd, opts, &count)) {
+			engine_last_set(FSOP_ENGINE_CLONE);
+			return count;
+		}
+
+		if (!regular)
+			errno = EINVAL;
+
+		if (clone == FSOP_CLONE_ALWAYS || !engine_refused(errno))
+			return -1;
+	}
+
+	/* Sources with fewer allocated blocks than their size have holes */
+	if ((opts->flags & FSOP_OPT_SPARSE) && regular && (off_t) sst.st_blocks * 512 < sst.st_size) {
+		if (!engine_sparse(sfd, dfd, opts, &count))
+			return count;
+
+		if (!engine_refused(errno))
+			return -1;
+	}
+
+	/* Zero blocks can only be detected while passing through userspace */
+	if ((opts->flags & FSOP_OPT_ZERO_HOLES) && S_ISREG(dst.st_mode))
+		engine = FSOP_ENGINE_RDWR;
+	else if ((opts->flags & FSOP_OPT_PREALLOC) && regular)
+		_fsop_prealloc(sfd, dfd, &sst);
+
+#ifdef CONFIG_DIRECT
+	/* Buffered engines take over whatever direct I/O refuses */
+	if (((opts->flags & FSOP_OPT_DIRECT) || engine == FSOP_ENGINE_DIRECT) && engine != FSOP_ENGINE_RDWR && regular) {
+		if ((ret = _fsop_fxchg_try(FSOP_ENGINE_DIRECT, &engine_direct, sfd, dfd, opts, &count)))
+			goto _done;
+	}
+#endif
+
+#ifdef __linux__
+	if (engine != FSOP_ENGINE_RDWR) {
+		if ((!engine || engine == FSOP_ENGINE_COPY_FILE_RANGE) && regular) {
+			if ((ret = _fsop_fxchg_try(FSOP_ENGINE_COPY_FILE_RANGE, &engine_copy_file_range, sfd, dfd, opts, &count)))
+				goto _done;
+		}
+
+#ifdef CONFIG_URING
+		if (((!engine && opts->qdepth) || engine == FSOP_ENGINE_URING) && regular) {
+			if ((ret = _fsop_fxchg_try(FSOP_ENGINE_URING, &engine_uring, sfd, dfd, opts, &count)))
+				goto _done;
+		}
+#endif
+
+		if ((!engine || engine == FSOP_ENGINE_SENDFILE) && S_ISREG(sst.st_mode)) {
+			if ((ret = _fsop_fxchg_try(FSOP_ENGINE_SENDFILE, &engine_sendfile, sfd, dfd, opts, &count)))
+				goto _done;
+		}
+
+		if (!engine || engine == FSOP_ENGINE_SPLICE) {
+			if ((ret = _fsop_fxchg_try(FSOP_ENGINE_SPLICE, &engine_splice, sfd, dfd, opts, &count)))
+				goto _done;
+		}
+	}
+#endif
+
+	if (engine_rdwr(sfd, dfd, opts, &count) < 0)
+		return -1;
+
+	engine_last_set(FSOP_ENGINE_RDWR);
+
+	return count;
+
+#if defined(__linux__) || defined(CONFIG_DIRECT)
+_done:
+	return ret < 0 ? -1 : (ssize_t) count;
+#endif
+}
+
+static ssize_t _fsop_fxchg_checked(int sfd, int dfd, const struct fsop_opts *opts) {
+	int algo = opts->checksum ? opts->checksum : FSOP_CHECKSUM_CRC32C;
+	ssize_t count = 0;
+	off_t soff = -1, doff = -1, len = 0;
+	struct stat sst, dst;
+	struct fsop_opts ropts;
+	struct checksum sck, dck;
+
+	if (checksum_init(&sck, algo) < 0)
+		return -1;
+
+	STATS_ADD(FSOP_STAT_SYS_STAT, 2);
+
+	if (fstat(sfd, &sst) < 0 || fstat(dfd, &dst) < 0)
+		return -1;
+
+	/* Only regular files are read back */
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (S_ISREG(sst.st_mode) && (soff = lseek(sfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	if (S_ISREG(dst.st_mode) && (doff = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	/* Data that can't be read again must be hashed on its way through. When
+	 * the engine is left to the library, the read/write loop is preferred over
+	 * in-kernel transfers too, as those would have to be read back.
+	 */
+	if (soff < 0 || (opts->engine == FSOP_ENGINE_AUTO && !(opts->flags & FSOP_OPT_DIRECT))) {
+		memcpy(&ropts, opts, sizeof(struct fsop_opts));
+
+		ropts.engine = FSOP_ENGINE_RDWR;
+
+		if (soff < 0)
+			ropts.clone = FSOP_CLONE_NEVER;
+
+		opts = &ropts;
+	}
+
+	engine_checksum_set(&sck);
+
+	count = _fsop_fxchg_engines(sfd, dfd, opts);
+
+	engine_checksum_set(NULL);
+
+	if (count < 0)
+		return -1;
+
+	/* The copied range is measured on the source offset */
+	if (soff >= 0) {
+		STATS_INC(FSOP_STAT_SYS_SEEK);
+
+		if ((len = lseek(sfd, 0, SEEK_CUR)) < 0)
+			return -1;
+
+		len -= soff;
+
+		/* In-kernel transfers, or a transfer resumed by the read/write loop */
+		if ((off_t) sck.total != len) {
+			checksum_init(&sck, algo);
+
+			if (checksum_fd(&sck, sfd, soff, len) < 0)
+				return -1;
+		}
+	} else {
+		len = sck.total;
+	}
+
+	if ((opts->flags & FSOP_OPT_VERIFY) && doff >= 0) {
+		checksum_init(&dck, algo);
+
+		if (checksum_fd(&dck, dfd, doff, len) < 0)
+			return -1;
+
+		if (dck.total != sck.total || checksum_final(&dck) != checksum_final(&sck)) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	if (opts->digest)
+		*opts->digest = checksum_final(&sck);
+
+	return count;
+}
+
+static ssize_t _fsop_fxchg(int sfd, int dfd, const struct fsop_opts *opts) {
+	int errsv = 0, stream = 0;
 	ssize_t count = 0;
-	char *buf = NULL;
+	unsigned long long t = 0;
+	struct engine_stream es;
+
+	STATS_TIME_START(t);
+
+	/* Batched durability starts the write-out while the data is copied */
+	if ((opts->flags & FSOP_OPT_NOCACHE) || (opts->_durable && opts->durability == FSOP_DURABILITY_BATCH)) {
+		engine_stream_begin(&es, sfd, dfd, opts->flags & FSOP_OPT_NOCACHE);
+		stream = 1;
+	}
+
+	if (opts->checksum || (opts->flags & FSOP_OPT_VERIFY))
+		count = _fsop_fxchg_checked(sfd, dfd, opts);
+	else
+		count = _fsop_fxchg_engines(sfd, dfd, opts);
 
-	if (!(buf = mm_alloc(block))) {
+	if (stream) {
 		errsv = errno;
-		goto _error2;
+		engine_stream_end(&es);
+		errno = errsv;
 	}
 
-	while ((ret = read(sfd, buf, block)) == block) {
-		if (write(dfd, buf, block) != block)
-			goto _error;
+	if (count < 0)
+		return -1;
+
+	STATS_TIME_STOP(t, FSOP_STAT_TIME_COPY);
+	STATS_ADD(FSOP_STAT_BYTES, count);
+	STATS_INC(FSOP_STAT_FILES);
+	STATS_INC(FSOP_STAT_ENGINE_RDWR + fsop_engine_last() - FSOP_ENGINE_RDWR);
+
+	if (progress_file(opts) < 0)
+		return -1;
+
+	return count;
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_opts_init(struct fsop_opts *opts, size_t block) {
+	memset(opts, 0, sizeof(struct fsop_opts));
+
+	opts->block = block;
+	opts->engine = FSOP_ENGINE_AUTO;
+}
+
+#ifndef COMPILE_WIN32
+/* Writes a new hidden name, next to 'dest', into 'name' */
+static void _fsop_atomic_name(char *name, const char *dest) {
+	const char *base = strrchr(dest, '/');
+	unsigned int id = 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	id = __sync_fetch_and_add(&_fsop_atomic_seq, 1) ^ (unsigned int) ts.tv_nsec ^ ((unsigned int) getpid() * 2654435761U);
+
+	base = base ? base + 1 : dest;
+
+	sprintf(name, "%.*s.%.200s.%08x", (int) (base - dest), dest, base, id);
+}
+
+static int _fsop_atomic_open(struct _fsop_atomic *at, const char *dest, int flags, mode_t mode) {
+	int fd = -1, i = 0, errsv = 0;
+	size_t len = strlen(dest);
+	const char *base = strrchr(dest, '/');
+
+	at->anon = 0;
+
+	if (!(at->tmp = mm_alloc(len + 16)))
+		return -1;
+
+#ifdef O_TMPFILE
+	/* An unnamed file leaves nothing behind if the copy never completes */
+	if (!base) {
+		strcpy(at->tmp, ".");
+	} else {
+		memcpy(at->tmp, dest, base == dest ? 1 : base - dest);
+		at->tmp[base == dest ? 1 : base - dest] = 0;
+	}
 
-		count += block;
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+	if ((fd = open(at->tmp, O_TMPFILE | O_RDWR, mode)) >= 0) {
+		at->anon = 1;
+		return fd;
 	}
+#else
+	(void) base;
+#endif
+
+	/* Not supported by the kernel or the file system. Use a hidden name. */
+	for (i = 0; i < FILE_TMP_TRIES; i ++) {
+		_fsop_atomic_name(at->tmp, dest);
+
+		STATS_INC(FSOP_STAT_SYS_OPEN);
+
+		if ((fd = open(at->tmp, flags | O_CREAT | O_EXCL, mode)) >= 0)
+			return fd;
+
+		if (errno != EEXIST)
+			break;
+	}
+
+	errsv = errno;
+	mm_free(at->tmp);
+	errno = errsv;
+
+	return -1;
+}
+
+static int _fsop_atomic_link(int fd, const char *path) {
+#ifdef O_TMPFILE
+	char proc[64];
+
+	sprintf(proc, "/proc/self/fd/%d", fd);
+
+	if (!linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW))
+		return 0;
+
+	/* Works without /proc, but only with CAP_DAC_READ_SEARCH */
+	if (errno == ENOENT)
+		return linkat(fd, "", AT_FDCWD, path, AT_EMPTY_PATH);
+#else
+	(void) fd;
+	(void) path;
+
+	errno = ENOSYS;
+#endif
+	return -1;
+}
 
-	if (ret >= 0) {
-		if (write(dfd, buf, ret) != ret)
+/* Moves the complete file over 'dest', releasing the temporary identity */
+static int _fsop_atomic_commit(struct _fsop_atomic *at, int fd, const char *dest) {
+	int i = 0, errsv = 0;
+
+	if (at->anon) {
+		/* Nothing to replace: the file appears under its final name */
+		if (!_fsop_atomic_link(fd, dest))
+			goto _done;
+
+		if (errno != EEXIST)
 			goto _error;
 
-		count += ret;
-	} else {
-		goto _error;
+		/* Rename cannot take an unnamed file, so name it first */
+		for (i = 0; i < FILE_TMP_TRIES; i ++) {
+			_fsop_atomic_name(at->tmp, dest);
+
+			if (!_fsop_atomic_link(fd, at->tmp))
+				break;
+
+			if (errno != EEXIST)
+				goto _error;
+		}
+
+		if (i == FILE_TMP_TRIES)
+			goto _error;
+
+		at->anon = 0;
 	}
 
-	mm_free(buf);
+	STATS_INC(FSOP_STAT_SYS_RENAME);
 
-	return count;
+	if (rename(at->tmp, dest) < 0)
+		goto _error;
+
+_done:
+	mm_free(at->tmp);
+
+	return 0;
 
 _error:
 	errsv = errno;
-	mm_free(buf);
-_error2:
+
+	if (!at->anon) {
+		STATS_INC(FSOP_STAT_SYS_UNLINK);
+		unlink(at->tmp);
+	}
+
+	mm_free(at->tmp);
+
 	errno = errsv;
+
 	return -1;
 }
 
-#ifdef COMPILE_WIN32
-DLLIMPORT
+/* Discards the incomplete file */
+static void _fsop_atomic_abort(struct _fsop_atomic *at) {
+	int errsv = errno;
+
+	if (!at->anon) {
+		STATS_INC(FSOP_STAT_SYS_UNLINK);
+		unlink(at->tmp);
+	}
+
+	mm_free(at->tmp);
+
+	errno = errsv;
+}
 #endif
-ssize_t fsop_frecv(int sfd, const char *file, mode_t mode, size_t block) {
-	int dfd = 0;
-	ssize_t count = 0;
 
-	fsop_unlink(file);
+/* Creates the destination file, under a temporary identity in atomic mode */
+static int _fsop_dest_open(const char *dest, mode_t mode, const struct fsop_opts *opts, struct _fsop_atomic *at) {
+	/* Verification reads the destination back */
+	int flags = (opts->flags & FSOP_OPT_VERIFY) ? O_RDWR : O_WRONLY;
 
-	if ((dfd = open(file, O_WRONLY | O_CREAT, mode)) < 0)
-		return -1;
+#ifndef COMPILE_WIN32
+	if (opts->flags & FSOP_OPT_ATOMIC)
+		return _fsop_atomic_open(at, dest, flags, mode);
+#else
+	(void) at;
+#endif
 
-	if ((count = _fsop_fxchg(sfd, dfd, block)) < 0)
-		return -1;
+	fsop_unlink(dest);
+
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+	return open(dest, flags | O_CREAT, mode);
+}
+
+/* Closes the destination file, which only replaces 'dest' if 'count' is valid */
+static ssize_t _fsop_dest_close(int dfd, const char *dest, ssize_t count, const struct fsop_opts *opts, struct _fsop_atomic *at) {
+	int errsv = errno;
+
+	/* Data is flushed before it replaces the destination */
+	if (count >= 0 && durable_file(opts, dfd, dest) < 0) {
+		errsv = errno;
+		count = -1;
+	}
+
+#ifndef COMPILE_WIN32
+	if (opts->flags & FSOP_OPT_ATOMIC) {
+		if (count < 0) {
+			_fsop_atomic_abort(at);
+		} else if (_fsop_atomic_commit(at, dfd, dest) < 0) {
+			errsv = errno;
+			count = -1;
+		}
+	}
+#else
+	(void) at;
+#endif
 
 	_fsop_close_safe(dfd);
 
+	CACHE_INVALIDATE(dest);
+
+	errno = errsv;
+
 	return count;
 }
 
+static ssize_t _fsop_frecv(int sfd, const char *file, mode_t mode, const struct fsop_opts *opts) {
+	int dfd = 0;
+	struct _fsop_atomic at;
+
+	progress_path(opts, file);
+
+	if ((dfd = _fsop_dest_open(file, mode, opts, &at)) < 0)
+		return -1;
+
+	return _fsop_dest_close(dfd, file, _fsop_fxchg(sfd, dfd, opts), opts, &at);
+}
+
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-ssize_t fsop_fsend(int dfd, const char *file, size_t block) {
-	int sfd = 0;
+ssize_t fsop_frecv_ext(int sfd, const char *file, mode_t mode, const struct fsop_opts *opts) {
+	struct progress pg;
+	struct durable dg;
+	struct fsop_opts popts, dopts;
+
+	opts = progress_begin(&pg, &popts, opts);
+	opts = durable_begin(&dg, &dopts, opts);
+
+	return progress_end(&pg, opts, durable_end(&dg, opts, _fsop_frecv(sfd, file, mode, opts)));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_frecv(int sfd, const char *file, mode_t mode, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_frecv_ext(sfd, file, mode, &opts);
+}
+
+static ssize_t _fsop_fsend(int dfd, const char *file, const struct fsop_opts *opts) {
+	int sfd = 0, errsv = 0;
 	ssize_t count = 0;
 
+	progress_path(opts, file);
+
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
 	if ((sfd = open(file, O_RDONLY)) < 0)
 		return -1;
 
-	if ((count = _fsop_fxchg(sfd, dfd, block)) < 0)
+	if ((count = _fsop_fxchg(sfd, dfd, opts)) < 0) {
+		errsv = errno;
+		_fsop_close_safe(sfd);
+		errno = errsv;
 		return -1;
+	}
 
 	_fsop_close_safe(sfd);
 
@@ -126,44 +639,253 @@ ssize_t fsop_fsend(int dfd, const char *file, size_t block) {
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-ssize_t fsop_cp(const char *src, const char *dest, size_t block) {
-	int dfd = 0;
+ssize_t fsop_fsend_ext(int dfd, const char *file, const struct fsop_opts *opts) {
+	struct progress pg;
+	struct fsop_opts popts;
+
+	opts = progress_begin(&pg, &popts, opts);
+
+	return progress_end(&pg, opts, _fsop_fsend(dfd, file, opts));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_fsend(int dfd, const char *file, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_fsend_ext(dfd, file, &opts);
+}
+
+#ifndef COMPILE_WIN32
+static int _fsop_same_content(int sfd, int dfd, off_t size, const struct fsop_opts *opts) {
+	int ret = 1, errsv = 0;
+	off_t off = 0;
+	ssize_t sr = 0, dr = 0;
+	size_t block = opts->block ? opts->block : FILE_CMP_BLOCK;
+	struct mm_buf sbuf, dbuf;
+
+	if (mm_buf_get(&sbuf, block) < 0)
+		return -1;
+
+	if (mm_buf_get(&dbuf, block) < 0) {
+		errsv = errno;
+		mm_buf_put(&sbuf);
+		errno = errsv;
+		return -1;
+	}
+
+	for (off = 0; off < size; off += sr) {
+		STATS_ADD(FSOP_STAT_SYS_READ, 2);
+
+		if ((sr = pread(sfd, sbuf.ptr, block, off)) < 0 || (dr = pread(dfd, dbuf.ptr, sr, off)) < 0) {
+			ret = -1;
+			break;
+		}
+
+		/* A short read means the file changed size since it was stat'ed */
+		if (!sr || dr != sr || memcmp(sbuf.ptr, dbuf.ptr, sr)) {
+			ret = 0;
+			break;
+		}
+	}
+
+	errsv = errno;
+	mm_buf_put(&dbuf);
+	mm_buf_put(&sbuf);
+	errno = errsv;
+
+	return ret;
+}
+
+/* Returns 1 if 'dest' is up to date with the source, 0 if it must be copied */
+static int _fsop_sync_current(int sfd, const struct stat *sst, const char *dest, const struct fsop_opts *opts) {
+	int dfd = 0, ret = 0, errsv = 0;
+	struct stat dst;
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	/* Anything preventing the check is left for the copy to report */
+	if (stat(dest, &dst) < 0)
+		return 0;
+
+	if (!S_ISREG(dst.st_mode) || dst.st_size != sst->st_size)
+		return 0;
+
+	if (!(opts->flags & FSOP_OPT_SYNC_CONTENT))
+		return CONFIG_ST_MTIM(&dst).tv_sec == CONFIG_ST_MTIM(sst).tv_sec && CONFIG_ST_MTIM(&dst).tv_nsec == CONFIG_ST_MTIM(sst).tv_nsec;
+
+	STATS_INC(FSOP_STAT_SYS_OPEN);
+
+	if ((dfd = open(dest, O_RDONLY)) < 0)
+		return 0;
+
+	ret = _fsop_same_content(sfd, dfd, sst->st_size, opts);
+	errsv = errno;
+
+	_fsop_close_safe(dfd);
+
+	errno = errsv;
+
+	return ret;
+}
+#endif
+
+static ssize_t _fsop_cp(const char *src, const char *dest, const struct fsop_opts *opts) {
+	int sfd = 0, dfd = 0, errsv = 0;
 	ssize_t count = 0;
 	struct stat st;
+	struct _fsop_atomic at;
+#ifndef COMPILE_WIN32
+	int ret = 0, delta = 0;
+	struct stat dst;
+	struct timespec times[2];
+#endif
 
-	if (stat(src, &st) < 0)
-		return -1;
+	progress_path(opts, src);
 
-	fsop_unlink(dest);
+	STATS_INC(FSOP_STAT_SYS_OPEN);
 
-	if ((dfd = open(dest, O_WRONLY | O_CREAT, st.st_mode)) < 0)
+	if ((sfd = open(src, O_RDONLY)) < 0)
 		return -1;
 
-	count = fsop_fsend(dfd, src, block);
+	STATS_INC(FSOP_STAT_SYS_STAT);
 
-	_fsop_close_safe(dfd);
+	if (fstat(sfd, &st) < 0)
+		goto _error;
+
+#ifndef COMPILE_WIN32
+	if ((opts->flags & FSOP_OPT_SYNC) && S_ISREG(st.st_mode)) {
+		if ((ret = _fsop_sync_current(sfd, &st, dest, opts)) < 0)
+			goto _error;
+
+		if (ret) {
+			_fsop_close_safe(sfd);
+
+			STATS_INC(FSOP_STAT_FILES_SKIPPED);
+
+			return progress_file(opts) < 0 ? -1 : 0;
+		}
+	}
+#endif
+
+	dfd = -1;
+
+#ifndef COMPILE_WIN32
+	/* Delta copies need to read the current contents of the destination */
+	if ((opts->flags & FSOP_OPT_DELTA) && !(opts->flags & FSOP_OPT_ATOMIC) && S_ISREG(st.st_mode)) {
+		STATS_INC(FSOP_STAT_SYS_OPEN);
+
+		if ((dfd = open(dest, O_RDWR | O_NONBLOCK)) >= 0) {
+			STATS_INC(FSOP_STAT_SYS_STAT);
+
+			if (fstat(dfd, &dst) < 0 || !S_ISREG(dst.st_mode)) {
+				_fsop_close_safe(dfd);
+				dfd = -1;
+			} else {
+				delta = 1;
+			}
+		}
+	}
+#endif
+
+	if (dfd < 0 && (dfd = _fsop_dest_open(dest, st.st_mode, opts, &at)) < 0)
+		goto _error;
+
+	count = _fsop_fxchg(sfd, dfd, opts);
+	errsv = errno;
+
+#ifndef COMPILE_WIN32
+	/* Destinations updated in place take the permissions of their source */
+	if (count >= 0 && delta && (dst.st_mode & 07777) != (st.st_mode & 07777)) {
+		if (fchmod(dfd, st.st_mode & 07777) < 0) {
+			errsv = errno;
+			count = -1;
+		}
+	}
+
+	/* Copies carry the times of their source, so later syncs can skip them */
+	if (count >= 0 && (opts->flags & FSOP_OPT_SYNC) && S_ISREG(st.st_mode)) {
+		times[0] = CONFIG_ST_ATIM(&st);
+		times[1] = CONFIG_ST_MTIM(&st);
+
+		if (futimens(dfd, times) < 0) {
+			errsv = errno;
+			count = -1;
+		}
+	}
+#endif
+
+	errno = errsv;
+
+	count = _fsop_dest_close(dfd, dest, count, opts, &at);
+	errsv = errno;
+
+	_fsop_close_safe(sfd);
+
+	errno = errsv;
 
 	return count;
+
+_error:
+	errsv = errno;
+	_fsop_close_safe(sfd);
+	errno = errsv;
+	return -1;
 }
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-ssize_t fsop_mv(const char *from, const char *to, size_t block) {
+ssize_t fsop_cp_ext(const char *src, const char *dest, const struct fsop_opts *opts) {
+	struct progress pg;
+	struct durable dg;
+	struct fsop_opts popts, dopts;
+
+	opts = progress_begin(&pg, &popts, opts);
+	opts = durable_begin(&dg, &dopts, opts);
+
+	return progress_end(&pg, opts, durable_end(&dg, opts, _fsop_cp(src, dest, opts)));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_cp(const char *src, const char *dest, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_cp_ext(src, dest, &opts);
+}
+
+static ssize_t _fsop_mv(const char *from, const char *to, const struct fsop_opts *opts) {
 	ssize_t count = 0;
 	struct stat st;
 
+	STATS_INC(FSOP_STAT_SYS_RENAME);
+
 	if (!rename(from, to)) {
+		CACHE_INVALIDATE(from);
+		CACHE_INVALIDATE(to);
+
+		if (durable_entry(opts, to) < 0 || durable_entry(opts, from) < 0)
+			return -1;
+
+		STATS_INC(FSOP_STAT_SYS_STAT);
+
 		if (stat(to, &st) < 0)
 			return -1;
 
 		return st.st_size;
 	}
 
-	if ((count = fsop_cp(from, to, block)) < 0)
+	if ((count = fsop_cp_ext(from, to, opts)) < 0)
 		return -1;
 
-	if (fsop_unlink(from) < 0)
+	if (fsop_unlink(from) < 0 || durable_entry(opts, from) < 0)
 		return -1;
 
 	return count;
@@ -172,7 +894,37 @@ ssize_t fsop_mv(const char *from, const char *to, size_t block) {
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
-int fsop_unlink(const char *file) {
-	return unlink(file);
+ssize_t fsop_mv_ext(const char *from, const char *to, const struct fsop_opts *opts) {
+	struct durable dg;
+	struct fsop_opts dopts;
+
+	opts = durable_begin(&dg, &dopts, opts);
+
+	return durable_end(&dg, opts, _fsop_mv(from, to, opts));
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+ssize_t fsop_mv(const char *from, const char *to, size_t block) {
+	struct fsop_opts opts;
+
+	fsop_opts_init(&opts, block);
+
+	return fsop_mv_ext(from, to, &opts);
 }
 
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_unlink(const char *file) {
+	int ret = 0;
+
+	STATS_INC(FSOP_STAT_SYS_UNLINK);
+
+	ret = unlink(file);
+
+	CACHE_INVALIDATE(file);
+
+	return ret;
+}
@@ -25,14 +25,69 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include "config.h"
+#include "mm.h"
 
 #ifdef USE_LIBFSMA
  #include <fsma/fsma.h>
 #endif
 
+#ifndef COMPILE_WIN32
+ #include <pthread.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
+#endif
+
+#include "file.h"
+#include "stats.h"
+
+/* Default arena chunk size */
+#define MM_ARENA_CHUNK		16384
+
+/* Arena allocations alignment */
+#define MM_ARENA_ALIGN		(sizeof(void *) > sizeof(long long) ? sizeof(void *) : sizeof(long long))
+
+/* Default buffer pool parameters */
+#define MM_BUFPOOL_COUNT	16
+#define MM_BUFPOOL_SIZE		0
+
+/* Huge page size assumed for huge page backed buffers */
+#define MM_HUGEPAGE_SIZE	(2UL * 1024 * 1024)
+
+struct mm_arena_chunk {
+	struct mm_arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+struct mm_arena {
+	size_t chunk;
+	struct mm_arena_chunk *head;
+	struct mm_arena_chunk *cur;
+};
+
+static __thread struct mm_arena *_mm_arena_thread = NULL;
+
+#ifndef COMPILE_WIN32
+static pthread_key_t _mm_arena_key;
+static pthread_once_t _mm_arena_once = PTHREAD_ONCE_INIT;
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned int count;	/* Maximum number of cached buffers */
+	size_t size;		/* Minimum buffer size */
+	int flags;
+	unsigned int nfree;
+	struct mm_buf *free;	/* Cached buffers, 'count' entries */
+} _mm_bufpool = { PTHREAD_MUTEX_INITIALIZER, MM_BUFPOOL_COUNT, MM_BUFPOOL_SIZE, 0, 0, NULL };
+#endif
+
 void *mm_alloc(size_t size) {
+	STATS_INC(FSOP_STAT_ALLOCS);
+
 	return
 #ifdef USE_LIBFSMA
 	fsma_malloc(size);
@@ -42,6 +97,9 @@ void *mm_alloc(size_t size) {
 }
 
 void mm_free(void *ptr) {
+	if (ptr)
+		STATS_INC(FSOP_STAT_FREES);
+
 #ifdef USE_LIBFSMA
 	fsma_free(ptr);
 #else
@@ -50,6 +108,8 @@ void mm_free(void *ptr) {
 }
 
 void *mm_realloc(void *ptr, size_t size) {
+	STATS_INC(FSOP_STAT_ALLOCS);
+
 	return
 #ifdef USE_LIBFSMA
 	fsma_realloc(ptr, size);
@@ -59,6 +119,8 @@ void *mm_realloc(void *ptr, size_t size) {
 }
 
 void *mm_calloc(size_t nmemb, size_t size) {
+	STATS_INC(FSOP_STAT_ALLOCS);
+
 	return
 #ifdef USE_LIBFSMA
 	fsma_calloc(nmemb, size);
@@ -67,3 +129,280 @@ void *mm_calloc(size_t nmemb, size_t size) {
 #endif
 }
 
+
+struct mm_arena *mm_arena_create(size_t chunk) {
+	struct mm_arena *arena = NULL;
+
+	if (!(arena = mm_alloc(sizeof(struct mm_arena))))
+		return NULL;
+
+	arena->chunk = chunk ? chunk : MM_ARENA_CHUNK;
+	arena->head = NULL;
+	arena->cur = NULL;
+
+	return arena;
+}
+
+void mm_arena_destroy(struct mm_arena *arena) {
+	struct mm_arena_chunk *c = NULL, *next = NULL;
+
+	for (c = arena->head; c; c = next) {
+		next = c->next;
+		mm_free(c);
+	}
+
+	mm_free(arena);
+}
+
+static size_t _mm_arena_hdr(void) {
+	return (sizeof(struct mm_arena_chunk) + MM_ARENA_ALIGN - 1) & ~(MM_ARENA_ALIGN - 1);
+}
+
+void *mm_arena_alloc(struct mm_arena *arena, size_t size) {
+	struct mm_arena_chunk *c = arena->cur, *next = NULL;
+
+	STATS_INC(FSOP_STAT_ARENA_ALLOCS);
+
+	size = (size + MM_ARENA_ALIGN - 1) & ~(MM_ARENA_ALIGN - 1);
+
+	if (c && c->size - c->used >= size)
+		goto _bump;
+
+	/* Chunks after the current one are spare, left by a previous release */
+	next = c ? c->next : arena->head;
+
+	if (next && next->size >= size) {
+		c = next;
+	} else {
+		if (!(c = mm_alloc(_mm_arena_hdr() + (size > arena->chunk ? size : arena->chunk))))
+			return NULL;
+
+		c->size = size > arena->chunk ? size : arena->chunk;
+		c->next = next;
+
+		if (arena->cur)
+			arena->cur->next = c;
+		else
+			arena->head = c;
+	}
+
+	c->used = 0;
+	arena->cur = c;
+
+_bump:
+	c->used += size;
+
+	return (char *) c + _mm_arena_hdr() + c->used - size;
+}
+
+void mm_arena_mark(struct mm_arena *arena, struct mm_arena_mark *mark) {
+	mark->chunk = arena->cur;
+	mark->used = arena->cur ? arena->cur->used : 0;
+}
+
+void mm_arena_release(struct mm_arena *arena, const struct mm_arena_mark *mark) {
+	arena->cur = mark->chunk;
+
+	if (arena->cur)
+		arena->cur->used = mark->used;
+}
+
+void mm_arena_reset(struct mm_arena *arena) {
+	arena->cur = NULL;
+}
+
+#ifndef COMPILE_WIN32
+static void _mm_arena_key_destroy(void *arg) {
+	mm_arena_destroy(arg);
+}
+
+static void _mm_arena_key_create(void) {
+	pthread_key_create(&_mm_arena_key, &_mm_arena_key_destroy);
+}
+#endif
+
+struct mm_arena *mm_arena_thread(void) {
+	if (_mm_arena_thread)
+		return _mm_arena_thread;
+
+#ifndef COMPILE_WIN32
+	if ((errno = pthread_once(&_mm_arena_once, &_mm_arena_key_create)))
+		return NULL;
+#endif
+
+	if (!(_mm_arena_thread = mm_arena_create(0)))
+		return NULL;
+
+#ifndef COMPILE_WIN32
+	/* Released by the key destructor when the thread exits */
+	pthread_setspecific(_mm_arena_key, _mm_arena_thread);
+#endif
+
+	return _mm_arena_thread;
+}
+
+#ifndef COMPILE_WIN32
+static int _mm_buf_alloc(struct mm_buf *buf, size_t size, int flags) {
+	size_t align = sysconf(_SC_PAGESIZE);
+	void *ptr = NULL;
+	int errsv = 0;
+
+	buf->kind = MM_BUF_HEAP;
+
+	if ((flags & FSOP_BUFPOOL_HUGEPAGES) && size >= MM_HUGEPAGE_SIZE) {
+		size = (size + MM_HUGEPAGE_SIZE - 1) & ~(MM_HUGEPAGE_SIZE - 1);
+		align = MM_HUGEPAGE_SIZE;
+ #ifdef MAP_HUGETLB
+		/* Explicit huge pages, when reserved by the administrator */
+		if ((ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED) {
+			buf->kind = MM_BUF_MMAP;
+			goto _done;
+		}
+ #endif
+	} else {
+		size = (size + align - 1) & ~(align - 1);
+	}
+
+	if ((errsv = posix_memalign(&ptr, align, size))) {
+		errno = errsv;
+		return -1;
+	}
+
+ #ifdef MADV_HUGEPAGE
+	/* Otherwise, ask for transparent huge pages */
+	if (align == MM_HUGEPAGE_SIZE)
+		madvise(ptr, size, MADV_HUGEPAGE);
+ #endif
+
+ #ifdef MAP_HUGETLB
+_done:
+ #endif
+	buf->ptr = ptr;
+	buf->size = size;
+
+	return 0;
+}
+
+static void _mm_buf_release(struct mm_buf *buf) {
+	if (buf->kind == MM_BUF_MMAP)
+		munmap(buf->ptr, buf->size);
+	else
+		free(buf->ptr);
+
+	buf->ptr = NULL;
+}
+#endif
+
+int mm_buf_get(struct mm_buf *buf, size_t size) {
+#ifdef COMPILE_WIN32
+	buf->kind = MM_BUF_HEAP;
+	buf->size = size;
+
+	return (buf->ptr = mm_alloc(size)) ? 0 : -1;
+#else
+	unsigned int i = 0;
+	int flags = 0;
+
+	pthread_mutex_lock(&_mm_bufpool.lock);
+
+	for (i = _mm_bufpool.nfree; i --; ) {
+		if (_mm_bufpool.free[i].size < size)
+			continue;
+
+		*buf = _mm_bufpool.free[i];
+		_mm_bufpool.free[i] = _mm_bufpool.free[-- _mm_bufpool.nfree];
+
+		pthread_mutex_unlock(&_mm_bufpool.lock);
+
+		STATS_INC(FSOP_STAT_BUFPOOL_HITS);
+
+		return 0;
+	}
+
+	/* Round small requests up, so buffers remain interchangeable */
+	if (size < _mm_bufpool.size)
+		size = _mm_bufpool.size;
+
+	flags = _mm_bufpool.flags;
+
+	pthread_mutex_unlock(&_mm_bufpool.lock);
+
+	STATS_INC(FSOP_STAT_BUFPOOL_MISSES);
+
+	return _mm_buf_alloc(buf, size, flags);
+#endif
+}
+
+void mm_buf_put(struct mm_buf *buf) {
+#ifdef COMPILE_WIN32
+	mm_free(buf->ptr);
+#else
+	pthread_mutex_lock(&_mm_bufpool.lock);
+
+	if (!_mm_bufpool.free && _mm_bufpool.count)
+		_mm_bufpool.free = mm_alloc(_mm_bufpool.count * sizeof(struct mm_buf));
+
+	if (_mm_bufpool.free && _mm_bufpool.nfree < _mm_bufpool.count) {
+		_mm_bufpool.free[_mm_bufpool.nfree ++] = *buf;
+		buf->ptr = NULL;
+	}
+
+	pthread_mutex_unlock(&_mm_bufpool.lock);
+
+	if (buf->ptr)
+		_mm_buf_release(buf);
+#endif
+}
+
+#ifndef COMPILE_WIN32
+static void _mm_bufpool_release(void) {
+	unsigned int i = 0;
+
+	for (i = 0; i < _mm_bufpool.nfree; i ++)
+		_mm_buf_release(&_mm_bufpool.free[i]);
+
+	_mm_bufpool.nfree = 0;
+}
+#endif
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_bufpool_flush(void) {
+#ifndef COMPILE_WIN32
+	pthread_mutex_lock(&_mm_bufpool.lock);
+	_mm_bufpool_release();
+	pthread_mutex_unlock(&_mm_bufpool.lock);
+#endif
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_bufpool_config(unsigned int count, size_t size, int flags) {
+#ifdef COMPILE_WIN32
+	errno = ENOSYS;
+	return -1;
+#else
+	struct mm_buf *cache = NULL;
+
+	if (count && !(cache = mm_alloc(count * sizeof(struct mm_buf))))
+		return -1;
+
+	pthread_mutex_lock(&_mm_bufpool.lock);
+
+	_mm_bufpool_release();
+
+	if (_mm_bufpool.free)
+		mm_free(_mm_bufpool.free);
+
+	_mm_bufpool.free = cache;
+	_mm_bufpool.count = count;
+	_mm_bufpool.size = size;
+	_mm_bufpool.flags = flags;
+
+	pthread_mutex_unlock(&_mm_bufpool.lock);
+
+	return 0;
+#endif
+}
@@ -24,196 +24,398 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #include <unistd.h>
 
+#ifdef __linux__
+ #include <sys/sysmacros.h>
+#endif
+
 #include "config.h"
 #include "path.h"
+#include "cache.h"
+#include "stats.h"
+
+#if defined(__linux__) && defined(STATX_TYPE)
+ #define CONFIG_STATX	1
+#endif
+
+#ifndef COMPILE_WIN32
+ #ifdef CONFIG_STATX
+static int _path_statx_nosys = 0;
+
+static void _path_from_statx(struct fsop_path_info *info, const struct statx *stx) {
+	info->mask = stx->stx_mask & FSOP_PATH_INFO_ALL;
+	info->mode = stx->stx_mode;
+	info->nlink = stx->stx_nlink;
+	info->uid = stx->stx_uid;
+	info->gid = stx->stx_gid;
+	info->ino = stx->stx_ino;
+	info->dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	info->size = stx->stx_size;
+	info->blocks = stx->stx_blocks;
+	info->atime.tv_sec = stx->stx_atime.tv_sec;
+	info->atime.tv_nsec = stx->stx_atime.tv_nsec;
+	info->mtime.tv_sec = stx->stx_mtime.tv_sec;
+	info->mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+	info->ctime.tv_sec = stx->stx_ctime.tv_sec;
+	info->ctime.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+ #endif
+
+static void _path_from_stat(struct fsop_path_info *info, const struct stat *st) {
+	info->mask = FSOP_PATH_INFO_ALL;
+	info->mode = st->st_mode;
+	info->nlink = st->st_nlink;
+	info->uid = st->st_uid;
+	info->gid = st->st_gid;
+	info->ino = st->st_ino;
+	info->dev = st->st_dev;
+	info->size = st->st_size;
+	info->blocks = st->st_blocks;
+	info->atime = CONFIG_ST_ATIM(st);
+	info->mtime = CONFIG_ST_MTIM(st);
+	info->ctime = CONFIG_ST_CTIM(st);
+}
+
+static int _path_query(int dirfd, const char *path, unsigned int mask, int flags, struct fsop_path_info *info) {
+	struct stat st;
+ #ifdef CONFIG_STATX
+	struct statx stx;
+	int sync = 0;
+ #endif
+	int atflags = (flags & FSOP_PATH_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0;
+
+	memset(info, 0, sizeof(struct fsop_path_info));
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+ #ifdef CONFIG_STATX
+	/* Only the requested fields have to be fetched by the file system */
+	if (!__atomic_load_n(&_path_statx_nosys, __ATOMIC_RELAXED)) {
+  #ifdef AT_STATX_DONT_SYNC
+		if (flags & FSOP_PATH_DONT_SYNC)
+			sync = AT_STATX_DONT_SYNC;
+  #endif
+
+		if (!statx(dirfd, path, atflags | sync, mask & FSOP_PATH_INFO_ALL, &stx)) {
+			_path_from_statx(info, &stx);
+
+			return 0;
+		}
+
+		if (errno != ENOSYS)
+			return -1;
+
+		__atomic_store_n(&_path_statx_nosys, 1, __ATOMIC_RELAXED);
+	}
+ #endif
+
+	if (fstatat(dirfd, path, &st, atflags) < 0)
+		return -1;
+
+	_path_from_stat(info, &st);
+
+	return 0;
+}
+
+int fsop_path_info_at(int dirfd, const char *path, unsigned int mask, int flags, struct fsop_path_info *info) {
+ #ifdef CONFIG_PATH_CACHE
+	int errsv = 0;
+
+	/* Only absolute paths, or paths relative to the working directory, are
+	 * keyed by their own string.
+	 */
+	if (!cache_enabled || (dirfd != AT_FDCWD && path[0] != '/'))
+		return _path_query(dirfd, path, mask, flags, info);
+
+	if (cache_lookup(path, mask, flags, info)) {
+		if (!info->error)
+			return 0;
+
+		errno = info->error;
+
+		return -1;
+	}
+
+	/* The type and mode are always cached, for the predicates to hit */
+	if (_path_query(dirfd, path, mask | FSOP_PATH_INFO_TYPE | FSOP_PATH_INFO_MODE, flags, info) < 0) {
+		errsv = errno;
+
+		if (errsv == ENOENT || errsv == ENOTDIR) {
+			info->error = errsv;
+			cache_store(path, flags, info);
+			info->error = 0;
+		}
+
+		errno = errsv;
+
+		return -1;
+	}
+
+	cache_store(path, flags, info);
+
+	return 0;
+ #else
+	return _path_query(dirfd, path, mask, flags, info);
+ #endif
+}
+#endif
+
+static int _path_mode(const char *path, unsigned int mask, mode_t *mode) {
+#ifdef COMPILE_WIN32
+	struct stat st;
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	if (stat(path, &st) < 0)
+		return -1;
+
+	*mode = st.st_mode;
+#else
+	struct fsop_path_info info;
+
+	if (fsop_path_info_at(AT_FDCWD, path, mask, 0, &info) < 0)
+		return -1;
+
+	*mode = info.mode;
+#endif
+
+	return 0;
+}
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
 int fsop_path_exists(const char *path) {
-	return !stat(path, (struct stat [1]) { { 0 } });
+	mode_t mode = 0;
+
+	return !_path_mode(path, 0, &mode);
 }
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
 int fsop_path_isdir(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISDIR(st.st_mode);
+	return S_ISDIR(mode);
 }
 
 #ifdef COMPILE_WIN32
 DLLIMPORT
 #endif
 int fsop_path_isreg(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISREG(st.st_mode);
+	return S_ISREG(mode);
 }
 
 #ifndef COMPILE_WIN32
 int fsop_path_ischr(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISCHR(st.st_mode);
+	return S_ISCHR(mode);
 }
 
 int fsop_path_isblk(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISBLK(st.st_mode);
+	return S_ISBLK(mode);
 }
 
 int fsop_path_isfifo(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISFIFO(st.st_mode);
+	return S_ISFIFO(mode);
 }
 
 int fsop_path_islnk(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISLNK(st.st_mode);
+	return S_ISLNK(mode);
 }
 
 int fsop_path_issock(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE, &mode) < 0)
 		return -1;
 
-	return S_ISSOCK(st.st_mode);
+	return S_ISSOCK(mode);
 }
 
 int fsop_path_read_other(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IROTH);
+	return (mode & S_IROTH);
 }
 
 int fsop_path_read_group(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IRGRP);
+	return (mode & S_IRGRP);
 }
 
 int fsop_path_read_owner(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IRUSR);
+	return (mode & S_IRUSR);
 }
 
 int fsop_path_write_other(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IWOTH);
+	return (mode & S_IWOTH);
 }
 
 int fsop_path_write_group(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IWGRP);
+	return (mode & S_IWGRP);
 }
 
 int fsop_path_write_owner(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IWUSR);
+	return (mode & S_IWUSR);
 }
 
 int fsop_path_exec_other(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IXOTH);
+	return (mode & S_IXOTH);
 }
 
 int fsop_path_exec_group(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IXGRP);
+	return (mode & S_IXGRP);
 }
 
 int fsop_path_exec_owner(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return (st.st_mode & S_IXUSR);
+	return (mode & S_IXUSR);
 }
 
 mode_t fsop_path_mode(const char *path) {
-	struct stat st;
+	mode_t mode = 0;
 
-	if (stat(path, &st) < 0)
+	if (_path_mode(path, FSOP_PATH_INFO_TYPE | FSOP_PATH_INFO_MODE, &mode) < 0)
 		return -1;
 
-	return st.st_mode;
+	return mode;
 }
 
 uid_t fsop_path_owner(const char *path) {
-	struct stat st;
+	struct fsop_path_info info;
 
-	if (stat(path, &st) < 0)
+	if (fsop_path_info_at(AT_FDCWD, path, FSOP_PATH_INFO_UID, 0, &info) < 0)
 		return -1;
 
-	return st.st_uid;
+	return info.uid;
 }
 
 gid_t fsop_path_group(const char *path) {
-	struct stat st;
+	struct fsop_path_info info;
 
-	if (stat(path, &st) < 0)
+	if (fsop_path_info_at(AT_FDCWD, path, FSOP_PATH_INFO_GID, 0, &info) < 0)
 		return -1;
 
-	return st.st_gid;
+	return info.gid;
+}
+
+int fsop_path_info(const char *path, unsigned int mask, int flags, struct fsop_path_info *info) {
+	return fsop_path_info_at(AT_FDCWD, path, mask, flags, info);
+}
+
+ssize_t fsop_path_info_batch(const char *dir, const char **paths, size_t count, unsigned int mask, int flags, struct fsop_path_info *info) {
+	int dfd = AT_FDCWD, errsv = 0;
+	size_t i = 0;
+	ssize_t ret = 0;
+
+	if (dir) {
+		STATS_INC(FSOP_STAT_SYS_OPEN);
+
+		if ((dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < count; i ++) {
+		if (fsop_path_info_at(dfd, paths[i], mask, flags, &info[i]) < 0) {
+			info[i].error = errno;
+			continue;
+		}
+
+		ret ++;
+	}
+
+	if (dir) {
+		errsv = errno;
+
+		STATS_INC(FSOP_STAT_SYS_CLOSE);
+
+		close(dfd);
+
+		errno = errsv;
+	}
+
+	return ret;
 }
 #endif
@@ -0,0 +1,312 @@
+/**
+ * @file pool.c
+ * @brief File System Operations Library (libfsop)
+ *        Worker Pool interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "config.h"
+#include "mm.h"
+#include "pool.h"
+
+#ifdef CONFIG_POOL
+#include <pthread.h>
+
+#define POOL_DEQUE_MIN		64
+
+struct pool_task {
+	void (*fn) (void *arg);
+	void *arg;
+};
+
+struct pool_deque {
+	pthread_mutex_t lock;
+	struct pool_task *tasks;
+	size_t size;		/* Always a power of two */
+	size_t head;		/* Steal end */
+	size_t tail;		/* Owner end */
+};
+
+struct pool_worker {
+	struct pool *pool;
+	unsigned int id;
+	pthread_t thread;
+	struct pool_deque dq;
+};
+
+struct pool {
+	unsigned int nworkers;
+	unsigned int started;
+	unsigned int next;
+	struct pool_worker *workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	volatile size_t queued;		/* Tasks waiting on the deques */
+	volatile size_t pending;	/* Tasks not yet completed */
+	volatile unsigned int idle;
+	int shutdown;
+};
+
+static __thread struct pool_worker *_pool_self = NULL;
+
+static int _pool_deque_push(struct pool_deque *dq, const struct pool_task *task) {
+	size_t i = 0, n = 0;
+	struct pool_task *tasks = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if ((n = dq->tail - dq->head) == dq->size) {
+		if (!(tasks = mm_alloc(dq->size * 2 * sizeof(struct pool_task)))) {
+			pthread_mutex_unlock(&dq->lock);
+			return -1;
+		}
+
+		for (i = 0; i < n; i ++)
+			tasks[i] = dq->tasks[(dq->head + i) & (dq->size - 1)];
+
+		mm_free(dq->tasks);
+
+		dq->tasks = tasks;
+		dq->size *= 2;
+		dq->head = 0;
+		dq->tail = n;
+	}
+
+	dq->tasks[dq->tail ++ & (dq->size - 1)] = *task;
+
+	pthread_mutex_unlock(&dq->lock);
+
+	return 0;
+}
+
+static int _pool_deque_pop(struct pool_deque *dq, struct pool_task *task, int steal) {
+	int ret = 0;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if (dq->tail != dq->head) {
+		if (steal)
+			*task = dq->tasks[dq->head ++ & (dq->size - 1)];
+		else
+			*task = dq->tasks[-- dq->tail & (dq->size - 1)];
+
+		ret = 1;
+	}
+
+	pthread_mutex_unlock(&dq->lock);
+
+	return ret;
+}
+
+static int _pool_take(struct pool_worker *self, struct pool_task *task) {
+	unsigned int i = 0;
+	struct pool *pool = self->pool;
+
+	if (_pool_deque_pop(&self->dq, task, 0))
+		goto _taken;
+
+	for (i = 1; i < pool->nworkers; i ++) {
+		if (_pool_deque_pop(&pool->workers[(self->id + i) % pool->nworkers].dq, task, 1))
+			goto _taken;
+	}
+
+	return 0;
+
+_taken:
+	__sync_sub_and_fetch(&pool->queued, 1);
+
+	return 1;
+}
+
+static void *_pool_worker(void *arg) {
+	struct pool_worker *self = arg;
+	struct pool *pool = self->pool;
+	struct pool_task task;
+
+	_pool_self = self;
+
+	for (;;) {
+		if (_pool_take(self, &task)) {
+			task.fn(task.arg);
+
+			if (!__sync_sub_and_fetch(&pool->pending, 1)) {
+				pthread_mutex_lock(&pool->lock);
+				pthread_cond_broadcast(&pool->done);
+				pthread_mutex_unlock(&pool->lock);
+			}
+
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		/* Pairs with the barriers in pool_submit(): either the submitter sees
+		 * this worker as idle, or this worker sees the queued task.
+		 */
+		__sync_add_and_fetch(&pool->idle, 1);
+
+		while (!pool->shutdown && !__sync_fetch_and_add(&pool->queued, 0))
+			pthread_cond_wait(&pool->work, &pool->lock);
+
+		__sync_sub_and_fetch(&pool->idle, 1);
+
+		if (pool->shutdown && !pool->queued) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+struct pool *pool_create(unsigned int workers) {
+	int errsv = 0;
+	unsigned int i = 0;
+	struct pool *pool = NULL;
+	struct pool_worker *w = NULL;
+
+	if (!workers) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(pool = mm_calloc(1, sizeof(struct pool))))
+		return NULL;
+
+	if (!(pool->workers = mm_calloc(workers, sizeof(struct pool_worker)))) {
+		errsv = errno;
+		mm_free(pool);
+		errno = errsv;
+		return NULL;
+	}
+
+	pool->nworkers = workers;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < workers; i ++) {
+		w = &pool->workers[i];
+		w->pool = pool;
+		w->id = i;
+
+		pthread_mutex_init(&w->dq.lock, NULL);
+
+		if (!(w->dq.tasks = mm_alloc(POOL_DEQUE_MIN * sizeof(struct pool_task)))) {
+			errsv = errno;
+			goto _error;
+		}
+
+		w->dq.size = POOL_DEQUE_MIN;
+	}
+
+	for (pool->started = 0; pool->started < workers; pool->started ++) {
+		w = &pool->workers[pool->started];
+
+		if ((errsv = pthread_create(&w->thread, NULL, &_pool_worker, w)))
+			goto _error;
+	}
+
+	return pool;
+
+_error:
+	pool_destroy(pool);
+
+	errno = errsv;
+
+	return NULL;
+}
+
+int pool_submit(struct pool *pool, void (*fn) (void *arg), void *arg) {
+	struct pool_worker *w = _pool_self;
+	struct pool_task task;
+
+	task.fn = fn;
+	task.arg = arg;
+
+	/* Tasks submitted from outside the pool are spread across the workers */
+	if (!w || w->pool != pool)
+		w = &pool->workers[__sync_fetch_and_add(&pool->next, 1) % pool->nworkers];
+
+	__sync_add_and_fetch(&pool->pending, 1);
+
+	if (_pool_deque_push(&w->dq, &task) < 0) {
+		__sync_sub_and_fetch(&pool->pending, 1);
+		return -1;
+	}
+
+	__sync_add_and_fetch(&pool->queued, 1);
+
+	if (__sync_fetch_and_add(&pool->idle, 0)) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return 0;
+}
+
+void pool_wait(struct pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+
+	while (__sync_fetch_and_add(&pool->pending, 0))
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(struct pool *pool) {
+	unsigned int i = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->started; i ++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (i = 0; i < pool->nworkers; i ++) {
+		pthread_mutex_destroy(&pool->workers[i].dq.lock);
+
+		if (pool->workers[i].dq.tasks)
+			mm_free(pool->workers[i].dq.tasks);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+
+	mm_free(pool->workers);
+	mm_free(pool);
+}
+#endif
@@ -0,0 +1,186 @@
+/**
+ * @file progress.c
+ * @brief File System Operations Library (libfsop)
+ *        Progress Reporting interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include "config.h"
+#include "progress.h"
+
+/* Path of the file being copied by the current thread */
+static __thread const char *_progress_cur = NULL;
+
+static unsigned long long _progress_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Issues a report, unless another thread is already doing so. The callback runs
+ * without any lock held, so it may safely take as long as it needs.
+ */
+static void _progress_report(struct progress *pg, const char *path, int done) {
+	unsigned long long now = 0, rewound = 0;
+
+	if (!__sync_bool_compare_and_swap(&pg->reporting, 0, 1))
+		return;
+
+	now = _progress_clock();
+	rewound = __atomic_exchange_n(&pg->rewound, 0, __ATOMIC_ACQ_REL);
+
+	/* Rewound bytes were counted by the previous report, so don't let them
+	 * distort the rate.
+	 */
+	pg->last_bytes = pg->last_bytes > rewound ? pg->last_bytes - rewound : 0;
+
+	pg->report.bytes = __atomic_load_n(&pg->bytes, __ATOMIC_ACQUIRE);
+	pg->report.files = __atomic_load_n(&pg->files, __ATOMIC_ACQUIRE);
+	pg->report.entries = __atomic_load_n(&pg->entries, __ATOMIC_ACQUIRE);
+	pg->report.path = path;
+	pg->report.done = done;
+	pg->report.rate = 0.0;
+
+	if (now > pg->last_time && pg->report.bytes >= pg->last_bytes)
+		pg->report.rate = (pg->report.bytes - pg->last_bytes) * 1e9 / (now - pg->last_time);
+
+	if (pg->opts->progress(&pg->report, pg->opts->progress_arg))
+		__atomic_store_n(&pg->cancelled, 1, __ATOMIC_RELEASE);
+
+	pg->last_time = now;
+	pg->last_bytes = pg->report.bytes;
+
+	__atomic_store_n(&pg->reporting, 0, __ATOMIC_RELEASE);
+}
+
+static int _progress_check(struct progress *pg) {
+	if (!__atomic_load_n(&pg->cancelled, __ATOMIC_ACQUIRE))
+		return 0;
+
+	errno = ECANCELED;
+
+	return -1;
+}
+
+const struct fsop_opts *progress_begin(struct progress *pg, struct fsop_opts *copy, const struct fsop_opts *opts) {
+	/* Nothing to report, or already tracked by an outer operation */
+	if (!opts->progress || opts->_progress)
+		return opts;
+
+	memset(pg, 0, sizeof(struct progress));
+
+	pg->opts = opts;
+	pg->last_time = _progress_clock();
+
+	*copy = *opts;
+	copy->_progress = pg;
+
+	return copy;
+}
+
+ssize_t progress_end(struct progress *pg, const struct fsop_opts *opts, ssize_t ret) {
+	int errsv = errno;
+
+	if (opts->_progress != pg)
+		return ret;
+
+	/* Workers are gone by now, but a report of theirs may still be running */
+	while (__atomic_load_n(&pg->reporting, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	/* The final report can't abort an operation that already ended */
+	_progress_report(pg, NULL, 1);
+
+	errno = errsv;
+
+	return ret;
+}
+
+void progress_path(const struct fsop_opts *opts, const char *path) {
+	if (opts->_progress)
+		_progress_cur = path;
+}
+
+int progress_bytes(const struct fsop_opts *opts, size_t n) {
+	struct progress *pg = opts->_progress;
+
+	if (!pg)
+		return 0;
+
+	__sync_add_and_fetch(&pg->bytes, n);
+
+	if (pg->opts->progress_bytes && __sync_add_and_fetch(&pg->pending_bytes, n) >= (long long) pg->opts->progress_bytes && !_progress_check(pg)) {
+		__atomic_store_n(&pg->pending_bytes, 0, __ATOMIC_RELAXED);
+		_progress_report(pg, _progress_cur, 0);
+	}
+
+	return _progress_check(pg);
+}
+
+void progress_rewind(const struct fsop_opts *opts, size_t n) {
+	struct progress *pg = opts->_progress;
+
+	if (!pg)
+		return;
+
+	/* Bytes of a transfer about to be restarted by another engine */
+	__sync_sub_and_fetch(&pg->bytes, n);
+	__sync_add_and_fetch(&pg->rewound, n);
+
+	if (pg->opts->progress_bytes)
+		__sync_sub_and_fetch(&pg->pending_bytes, n);
+}
+
+int progress_file(const struct fsop_opts *opts) {
+	struct progress *pg = opts->_progress;
+
+	if (!pg)
+		return 0;
+
+	/* Counted only; the next threshold or the final report carries it */
+	__sync_add_and_fetch(&pg->files, 1);
+
+	return _progress_check(pg);
+}
+
+int progress_entry(const struct fsop_opts *opts, const char *path) {
+	struct progress *pg = opts->_progress;
+
+	if (!pg)
+		return 0;
+
+	__sync_add_and_fetch(&pg->entries, 1);
+
+	if (pg->opts->progress_entries && __sync_add_and_fetch(&pg->pending_entries, 1) >= (long long) pg->opts->progress_entries && !_progress_check(pg)) {
+		__atomic_store_n(&pg->pending_entries, 0, __ATOMIC_RELAXED);
+		_progress_report(pg, path, 0);
+	}
+
+	return _progress_check(pg);
+}
@@ -0,0 +1,257 @@
+/**
+ * @file stats.c
+ * @brief File System Operations Library (libfsop)
+ *        Statistics interface
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "config.h"
+#include "stats.h"
+
+#ifndef COMPILE_WIN32
+ #include <pthread.h>
+#endif
+
+static const char *_stats_names[FSOP_STAT_MAX] = {
+	"bytes",
+	"files",
+	"files_skipped",
+	"bytes_unchanged",
+	"bytes_rewritten",
+	"bytes_hashed",
+	"engine_rdwr",
+	"engine_copy_file_range",
+	"engine_sendfile",
+	"engine_splice",
+	"engine_clone",
+	"engine_io_uring",
+	"engine_direct",
+	"sys_open",
+	"sys_close",
+	"sys_read",
+	"sys_write",
+	"sys_seek",
+	"sys_stat",
+	"sys_getdents",
+	"sys_mkdir",
+	"sys_rmdir",
+	"sys_unlink",
+	"sys_rename",
+	"sys_truncate",
+	"sys_fallocate",
+	"sys_clone",
+	"sys_copy_file_range",
+	"sys_sendfile",
+	"sys_splice",
+	"sys_io_uring",
+	"sys_sync",
+	"sys_fadvise",
+	"walk_dirs",
+	"walk_entries",
+	"allocs",
+	"frees",
+	"arena_allocs",
+	"bufpool_hits",
+	"bufpool_misses",
+	"time_copy_ns",
+	"time_scan_ns",
+	"time_mkdir_ns"
+};
+
+#ifdef CONFIG_STATS
+/*
+ * Each thread only ever writes its own counters, with relaxed atomic stores,
+ * so no locking is required on the hot path. Readers sum all the registered
+ * threads, plus the totals left by the threads that already exited. Resetting
+ * takes a snapshot that is subtracted from later reads, so the counters of
+ * running threads are never written by another thread.
+ */
+struct _stats_thread {
+	unsigned long long value[FSOP_STAT_MAX];
+	struct _stats_thread *prev;
+	struct _stats_thread *next;
+};
+
+volatile int stats_enabled = 0;
+
+static __thread struct _stats_thread *_stats_self = NULL;
+static struct _stats_thread *_stats_threads = NULL;
+static unsigned long long _stats_retired[FSOP_STAT_MAX];
+static unsigned long long _stats_base[FSOP_STAT_MAX];
+
+ #ifndef COMPILE_WIN32
+static pthread_mutex_t _stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _stats_key;
+static pthread_once_t _stats_once = PTHREAD_ONCE_INIT;
+
+  #define _stats_lock()		pthread_mutex_lock(&_stats_mutex)
+  #define _stats_unlock()	pthread_mutex_unlock(&_stats_mutex)
+ #else
+  #define _stats_lock()		do { } while (0)
+  #define _stats_unlock()	do { } while (0)
+ #endif
+
+static void _stats_thread_exit(void *arg) {
+	int i = 0;
+	struct _stats_thread *self = arg;
+
+	_stats_lock();
+
+	for (i = 0; i < FSOP_STAT_MAX; i ++)
+		_stats_retired[i] += self->value[i];
+
+	if (self->prev)
+		self->prev->next = self->next;
+	else
+		_stats_threads = self->next;
+
+	if (self->next)
+		self->next->prev = self->prev;
+
+	_stats_unlock();
+
+	_stats_self = NULL;
+
+	/* Not allocated through mm_alloc(), which is itself instrumented */
+	free(self);
+}
+
+ #ifndef COMPILE_WIN32
+static void _stats_key_create(void) {
+	pthread_key_create(&_stats_key, &_stats_thread_exit);
+}
+ #endif
+
+static struct _stats_thread *_stats_thread(void) {
+	struct _stats_thread *self = NULL;
+
+	if (!(self = calloc(1, sizeof(struct _stats_thread))))
+		return NULL;
+
+ #ifndef COMPILE_WIN32
+	pthread_once(&_stats_once, &_stats_key_create);
+	pthread_setspecific(_stats_key, self);
+ #endif
+
+	_stats_lock();
+
+	if ((self->next = _stats_threads))
+		self->next->prev = self;
+
+	_stats_threads = self;
+
+	_stats_unlock();
+
+	return (_stats_self = self);
+}
+
+void stats_add(int counter, unsigned long long n) {
+	struct _stats_thread *self = _stats_self;
+
+	if (!self && !(self = _stats_thread()))
+		return;
+
+	__atomic_store_n(&self->value[counter], self->value[counter] + n, __ATOMIC_RELAXED);
+}
+
+unsigned long long stats_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _stats_sum(unsigned long long *value) {
+	int i = 0;
+	struct _stats_thread *t = NULL;
+
+	memcpy(value, _stats_retired, sizeof(_stats_retired));
+
+	for (t = _stats_threads; t; t = t->next) {
+		for (i = 0; i < FSOP_STAT_MAX; i ++)
+			value[i] += __atomic_load_n(&t->value[i], __ATOMIC_RELAXED);
+	}
+}
+#endif
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+int fsop_stats_enable(int enable) {
+#ifdef CONFIG_STATS
+	int prev = stats_enabled;
+
+	stats_enabled = !!enable;
+
+	return prev;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_stats_get(struct fsop_stats *stats) {
+#ifdef CONFIG_STATS
+	int i = 0;
+
+	_stats_lock();
+
+	_stats_sum(stats->value);
+
+	for (i = 0; i < FSOP_STAT_MAX; i ++)
+		stats->value[i] -= _stats_base[i];
+
+	_stats_unlock();
+#else
+	memset(stats, 0, sizeof(struct fsop_stats));
+#endif
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+void fsop_stats_reset(void) {
+#ifdef CONFIG_STATS
+	_stats_lock();
+	_stats_sum(_stats_base);
+	_stats_unlock();
+#endif
+}
+
+#ifdef COMPILE_WIN32
+DLLIMPORT
+#endif
+const char *fsop_stats_name(int counter) {
+	if (counter < 0 || counter >= FSOP_STAT_MAX)
+		return NULL;
+
+	return _stats_names[counter];
+}
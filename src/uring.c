@@ -0,0 +1,504 @@
+/**
+ * @file uring.c
+ * @brief File System Operations Library (libfsop)
+ *        io_uring Copy Engine
+ *
+ * Date: 17-10-2026
+ *
+ * Copyright 2012-2015 Pedro A. Hortas (pah@ucodev.org)
+ *
+ * This file is part of libfsop.
+ *
+ * libfsop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfsop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfsop.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mm.h"
+#include "engine.h"
+#include "file.h"
+#include "stats.h"
+#include "progress.h"
+
+#ifdef CONFIG_URING
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Default number of requests kept in flight */
+#define URING_QDEPTH_DEFAULT	32
+
+struct _uring_slot {
+	off_t soff;
+	off_t doff;
+	size_t len;		/* Requested length */
+	ssize_t rlen;		/* Result of the last read, or -1 while in flight */
+	size_t rdone;		/* Bytes read */
+	size_t wdone;		/* Bytes written */
+	int busy;
+};
+
+struct _uring {
+	int fd;
+	unsigned int entries;
+	unsigned int nslots;
+	size_t block;
+	int fixed;		/* Buffers registered with the kernel */
+
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	char *bufs;
+	struct iovec *iov;
+	struct _uring_slot *slots;
+
+	unsigned int queued;	/* SQEs prepared but not yet published */
+	unsigned int pending;	/* SQEs published but not yet consumed by the kernel */
+	unsigned int inflight;	/* SQEs consumed but not yet completed */
+};
+
+static int _uring_nosys = 0;
+static pthread_key_t _uring_key;
+static pthread_once_t _uring_once = PTHREAD_ONCE_INIT;
+
+static void _uring_destroy(struct _uring *ring) {
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+
+	if (ring->bufs)
+		munmap(ring->bufs, ring->nslots * ring->block);
+
+	if (ring->iov)
+		mm_free(ring->iov);
+
+	if (ring->slots)
+		mm_free(ring->slots);
+
+	mm_free(ring);
+}
+
+static void _uring_key_destroy(void *arg) {
+	_uring_destroy(arg);
+}
+
+static void _uring_key_create(void) {
+	pthread_key_create(&_uring_key, &_uring_key_destroy);
+}
+
+static struct _uring *_uring_create(unsigned int nslots, size_t block) {
+	int errsv = 0;
+	unsigned int i = 0;
+	struct io_uring_params p;
+	struct _uring *ring = NULL;
+
+	if (!(ring = mm_calloc(1, sizeof(struct _uring))))
+		return NULL;
+
+	ring->fd = -1;
+	ring->nslots = nslots;
+	ring->block = block;
+
+	memset(&p, 0, sizeof(struct io_uring_params));
+
+	/* Each slot holds a linked read and write pair */
+	if ((ring->fd = syscall(__NR_io_uring_setup, nslots * 2, &p)) < 0)
+		goto _error;
+
+	ring->entries = p.sq_entries;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+
+		ring->cq_len = ring->sq_len;
+	}
+
+	if ((ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		goto _error;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else if ((ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		ring->cq_ptr = NULL;
+		goto _error;
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if ((ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto _error;
+	}
+
+	ring->sq_head = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned int *) ((char *) ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned int *) ((char *) ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + p.cq_off.cqes);
+
+	if ((ring->bufs = mmap(NULL, nslots * block, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		ring->bufs = NULL;
+		goto _error;
+	}
+
+	/* One iovec per slot for reads, followed by one per slot for writes */
+	if (!(ring->iov = mm_calloc(nslots * 2, sizeof(struct iovec))))
+		goto _error;
+
+	if (!(ring->slots = mm_calloc(nslots, sizeof(struct _uring_slot))))
+		goto _error;
+
+	for (i = 0; i < nslots; i ++) {
+		ring->iov[i].iov_base = ring->bufs + i * block;
+		ring->iov[i].iov_len = block;
+	}
+
+	/* Registration may be refused due to RLIMIT_MEMLOCK. Vectored requests
+	 * over the same buffers are used in that case.
+	 */
+	ring->fixed = !syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, ring->iov, nslots);
+
+	return ring;
+
+_error:
+	errsv = errno;
+	_uring_destroy(ring);
+	errno = errsv;
+	return NULL;
+}
+
+static struct _uring *_uring_get(unsigned int nslots, size_t block) {
+	struct _uring *ring = NULL;
+
+	/* Rings are kept per thread, so consecutive files (and the workers of a
+	 * parallel tree copy) do not pay the setup cost on every transfer.
+	 */
+	if (pthread_once(&_uring_once, &_uring_key_create))
+		return NULL;
+
+	if ((ring = pthread_getspecific(_uring_key))) {
+		if (ring->nslots == nslots && ring->block == block)
+			return ring;
+
+		pthread_setspecific(_uring_key, NULL);
+		_uring_destroy(ring);
+	}
+
+	if (!(ring = _uring_create(nslots, block)))
+		return NULL;
+
+	pthread_setspecific(_uring_key, ring);
+
+	return ring;
+}
+
+static void _uring_prep(struct _uring *ring, int op, int fd, unsigned int slot, size_t off, size_t len, off_t foff, int flags, int wr) {
+	unsigned int tail = *ring->sq_tail + ring->queued;
+	unsigned int idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	sqe->fd = fd;
+	sqe->flags = flags;
+	sqe->off = foff;
+	sqe->user_data = ((__u64) slot << 1) | wr;
+
+	if (ring->fixed) {
+		sqe->opcode = op == IORING_OP_READV ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe->addr = (unsigned long) (ring->bufs + slot * ring->block + off);
+		sqe->len = len;
+		sqe->buf_index = slot;
+	} else {
+		/* The iovecs of each slot are rewritten here, and only read by the
+		 * kernel at submission time. Reads and writes have their own, as
+		 * a resubmitted read may cover less than the write linked to it.
+		 */
+		struct iovec *iov = &ring->iov[wr ? ring->nslots + slot : slot];
+
+		iov->iov_base = ring->bufs + slot * ring->block + off;
+		iov->iov_len = len;
+
+		sqe->opcode = op;
+		sqe->addr = (unsigned long) iov;
+		sqe->len = 1;
+	}
+
+	ring->sq_array[idx] = idx;
+	ring->queued ++;
+}
+
+static int _uring_submit(struct _uring *ring, unsigned int wait) {
+	int ret = 0;
+
+	/* Publish the new SQEs. Any left over from a partial submission are
+	 * already in the ring and are only handed to the kernel again.
+	 */
+	if (ring->queued) {
+		__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+
+		ring->pending += ring->queued;
+		ring->queued = 0;
+	}
+
+	/* Never wait with nothing that could complete */
+	if (!ring->inflight && !ring->pending)
+		wait = 0;
+
+	do {
+		STATS_INC(FSOP_STAT_SYS_URING);
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -1;
+
+	ring->pending -= ret;
+	ring->inflight += ret;
+
+	return 0;
+}
+
+static int _uring_reap(struct _uring *ring, struct io_uring_cqe *cqe) {
+	unsigned int head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	*cqe = ring->cqes[head & *ring->cq_mask];
+
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	ring->inflight --;
+
+	return 1;
+}
+
+static void _uring_drain(struct _uring *ring) {
+	struct io_uring_cqe cqe;
+
+	/* SQEs that were never published are simply dropped */
+	ring->queued = 0;
+
+	/* Buffers cannot be reused while the kernel may still be accessing them,
+	 * and published SQEs would be consumed by the next submission anyway.
+	 */
+	while (ring->inflight || ring->pending) {
+		if (_uring_reap(ring, &cqe))
+			continue;
+
+		if (_uring_submit(ring, 1) < 0) {
+			/* The ring is left in an unknown state. Detach it from this
+			 * thread and leak it, as its buffers may still be in use.
+			 */
+			pthread_setspecific(_uring_key, NULL);
+			break;
+		}
+	}
+}
+
+int engine_uring(int sfd, int dfd, const struct fsop_opts *opts, size_t *count) {
+	int errsv = 0;
+	unsigned int i = 0, nslots = 0, active = 0;
+	off_t sbase = 0, dbase = 0, next = 0, end = 0;
+	size_t done = 0;
+	struct stat st;
+	struct io_uring_cqe cqe;
+	struct _uring *ring = NULL;
+	struct _uring_slot *slot = NULL;
+
+	if (__atomic_load_n(&_uring_nosys, __ATOMIC_RELAXED)) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	STATS_INC(FSOP_STAT_SYS_STAT);
+
+	if (fstat(sfd, &st) < 0)
+		return -1;
+
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if ((sbase = lseek(sfd, 0, SEEK_CUR)) < 0 || (dbase = lseek(dfd, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	nslots = (opts->qdepth ? opts->qdepth : URING_QDEPTH_DEFAULT) / 2;
+
+	if (!nslots)
+		nslots = 1;
+
+	if (!(ring = _uring_get(nslots, opts->block))) {
+		/* No io_uring support on the running kernel, or disabled */
+		if (errno == ENOSYS || errno == EPERM) {
+			__atomic_store_n(&_uring_nosys, 1, __ATOMIC_RELAXED);
+			errno = ENOSYS;
+		}
+
+		return -1;
+	}
+
+	memset(ring->slots, 0, nslots * sizeof(struct _uring_slot));
+
+	next = sbase;
+	end = st.st_size;
+
+	while (next < end || active) {
+		/* Keep every free slot busy with a read linked to its write */
+		for (i = 0; i < nslots && next < end; i ++) {
+			slot = &ring->slots[i];
+
+			if (slot->busy)
+				continue;
+
+			slot->busy = 1;
+			slot->soff = next;
+			slot->doff = dbase + next - sbase;
+			slot->len = end - next < (off_t) ring->block ? (size_t) (end - next) : ring->block;
+			slot->rlen = -1;
+			slot->rdone = 0;
+			slot->wdone = 0;
+
+			_uring_prep(ring, IORING_OP_READV, sfd, i, 0, slot->len, slot->soff, IOSQE_IO_LINK, 0);
+			_uring_prep(ring, IORING_OP_WRITEV, dfd, i, 0, slot->len, slot->doff, 0, 1);
+
+			next += slot->len;
+			active ++;
+		}
+
+		if (_uring_submit(ring, 1) < 0)
+			goto _error;
+
+		while (_uring_reap(ring, &cqe)) {
+			slot = &ring->slots[cqe.user_data >> 1];
+
+			if (!(cqe.user_data & 1)) {
+				if (cqe.res < 0) {
+					errno = -cqe.res;
+					goto _error;
+				}
+
+				slot->rlen = cqe.res;
+				slot->rdone += cqe.res;
+
+				continue;
+			}
+
+			if (cqe.res == -ECANCELED && slot->rlen >= 0) {
+				if (!slot->rlen) {
+					/* End of file reached early: the source shrank */
+					slot->len = slot->rdone;
+
+					if (slot->soff + (off_t) slot->rdone < end)
+						end = slot->soff + slot->rdone;
+
+					if (next > end)
+						next = end;
+				} else if (slot->rdone < slot->len) {
+					/* A short read severed the link. Read the rest, and
+					 * write the whole block once it's complete.
+					 */
+					i = cqe.user_data >> 1;
+					slot->rlen = -1;
+
+					_uring_prep(ring, IORING_OP_READV, sfd, i, slot->rdone, slot->len - slot->rdone, slot->soff + slot->rdone, IOSQE_IO_LINK, 0);
+					_uring_prep(ring, IORING_OP_WRITEV, dfd, i, 0, slot->len, slot->doff, 0, 1);
+
+					continue;
+				}
+			} else if (cqe.res < 0) {
+				errno = -cqe.res;
+				goto _error;
+			} else {
+				slot->wdone += cqe.res;
+			}
+
+			if (slot->wdone < slot->len) {
+				/* Short or cancelled write. Resubmit the remainder. */
+				_uring_prep(ring, IORING_OP_WRITEV, dfd, cqe.user_data >> 1, slot->wdone, slot->len - slot->wdone, slot->doff + slot->wdone, 0, 1);
+				continue;
+			}
+
+			done += slot->len;
+			slot->busy = 0;
+			active --;
+
+			if (engine_progress(opts, slot->len) < 0)
+				goto _error;
+		}
+	}
+
+	STATS_ADD(FSOP_STAT_SYS_SEEK, 2);
+
+	if (lseek(sfd, sbase + done, SEEK_SET) < 0 || lseek(dfd, dbase + done, SEEK_SET) < 0)
+		return -1;
+
+	*count += done;
+
+	return 0;
+
+_error:
+	/* File offsets were never moved, so the next engine restarts from the
+	 * beginning of the transfer.
+	 */
+	errsv = errno;
+	_uring_drain(ring);
+	engine_rewind(opts, done);
+	errno = errsv;
+
+	return -1;
+}
+#endif